@@ -12,194 +12,3809 @@
 #include <chrono>
 #include <iomanip>
 #include <sstream>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include <deque>
+#include <atomic>
+#include <string_view>
+#include <cstdint>
+#include <map>
+#include <list>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+#include <bit>
+#include <array>
+#include <bitset>
 
 #ifdef _WIN32
 #include <windows.h>
+#include <conio.h>
+#include <io.h>
 #else
 #include <cstdlib>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#ifdef __linux__
+#include <dirent.h>
+#include <sys/syscall.h>
+#if defined(SYS_getdents64) && defined(STATX_BASIC_STATS)
+#define FSM_HAVE_GETDENTS 1 // raw getdents64 + statx scan backend
+#endif
+#include <poll.h>
+#include <sys/inotify.h>
+#define FSM_HAVE_INOTIFY 1 // live watcher
+#if __has_include(<sys/fanotify.h>)
+#include <sys/fanotify.h>
+#if defined(FAN_REPORT_DFID_NAME) && defined(FAN_MARK_FILESYSTEM)
+#define FSM_HAVE_FANOTIFY 1 // file-system-wide watcher, needs CAP_SYS_ADMIN
+#endif
+#endif
+#if defined(FSM_HAVE_GETDENTS) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#if defined(IORING_FEAT_RW_CUR_POS) // headers from 5.6+, which added OP_STATX
+#define FSM_HAVE_IO_URING 1 // asynchronous statx scan backend
+#endif
+#endif
 #endif
 
 namespace fs = std::filesystem;
 
+// ==================== File Metadata ====================
+// Type, size and modification time of a file system entry, captured together
+// so that building a Node costs a single stat instead of three lookups.
+// Modification times are nanoseconds since the epoch, as precise as the
+// file system keeps them, so that a change within the same second as the
+// previous look still compares unequal
+using FileTime = int64_t;
+constexpr FileTime nanosecondsPerSecond = 1'000'000'000;
+
+inline time_t toSeconds(FileTime time) {
+    return static_cast<time_t>(time / nanosecondsPerSecond - (time % nanosecondsPerSecond < 0));
+}
+
+struct FileStat {
+    bool exists = false;
+    bool isDirectory = false;
+    bool isSymlink = false; // only set by statNoFollow
+    FileTime lastModified = 0;
+    uintmax_t size = 0; // 0 for directories and special files
+    uint64_t inode = 0; // 0 if the platform does not report one
+};
+
+inline FileTime toFileTime(fs::file_time_type ftime) {
+    auto sctime = std::chrono::file_clock::to_sys(ftime);
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(sctime.time_since_epoch()).count();
+}
+
+#ifndef _WIN32
+inline FileStat fromStat(const struct stat& st) {
+    FileStat info;
+    info.exists = true;
+    info.isDirectory = S_ISDIR(st.st_mode);
+#ifdef __APPLE__
+    info.lastModified = FileTime(st.st_mtimespec.tv_sec) * nanosecondsPerSecond + st.st_mtimespec.tv_nsec;
+#else
+    info.lastModified = FileTime(st.st_mtim.tv_sec) * nanosecondsPerSecond + st.st_mtim.tv_nsec;
+#endif
+    info.size = S_ISREG(st.st_mode) ? static_cast<uintmax_t>(st.st_size) : 0;
+    info.inode = static_cast<uint64_t>(st.st_ino);
+    return info;
+}
+
+#ifdef FSM_HAVE_GETDENTS
+// Layout of the records returned by getdents64(2)
+struct LinuxDirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[1];
+};
+
+inline FileStat fromStatx(const struct statx& stx) {
+    FileStat info;
+    info.exists = true;
+    info.isDirectory = S_ISDIR(stx.stx_mode);
+    info.lastModified = FileTime(stx.stx_mtime.tv_sec) * nanosecondsPerSecond + stx.stx_mtime.tv_nsec;
+    info.size = S_ISREG(stx.stx_mode) ? static_cast<uintmax_t>(stx.stx_size) : 0;
+    info.inode = (stx.stx_mask & STATX_INO) ? static_cast<uint64_t>(stx.stx_ino) : 0;
+    return info;
+}
+
+// Calls onEntry(name, d_type) for every entry of an open directory except
+// "." and "..". Returns false (with errno set) if getdents64 fails.
+template <typename Callback>
+bool readDirents(int dirFd, std::vector<char>& buffer, Callback&& onEntry) {
+    while (true) {
+        long bytes = ::syscall(SYS_getdents64, dirFd, buffer.data(), buffer.size());
+        if (bytes == 0) return true;
+        if (bytes < 0) return false;
+
+        for (long offset = 0; offset < bytes;) {
+            auto* entry = reinterpret_cast<LinuxDirent64*>(buffer.data() + offset);
+            offset += entry->d_reclen;
+
+            const char* name = entry->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+                continue;
+            }
+            onEntry(name, entry->d_type);
+        }
+    }
+}
+
+// statx mask for an entry; directories need their mtime and inode (for
+// incremental refresh) but no size
+inline unsigned int statxMask(unsigned char dType) {
+    return dType == DT_DIR
+        ? (STATX_TYPE | STATX_MTIME | STATX_INO)
+        : (STATX_TYPE | STATX_SIZE | STATX_MTIME | STATX_INO);
+}
+
+// One statx per entry, relative to the open directory so the kernel does
+// not walk the full path again
+inline FileStat statAt(int dirFd, const char* name, unsigned char dType) {
+    struct statx stx;
+    if (::statx(dirFd, name, 0, statxMask(dType), &stx) == 0) {
+        return fromStatx(stx);
+    }
+    if (errno == ENOSYS) { // Kernel older than 4.11
+        struct stat st;
+        if (::fstatat(dirFd, name, &st, 0) == 0) return fromStat(st);
+    }
+    return FileStat{}; // e.g. a dangling symlink
+}
+
+// d_type answers this without a syscall except on file systems that
+// report DT_UNKNOWN
+inline bool isSymlinkAt(int dirFd, const char* name, unsigned char dType) {
+    if (dType != DT_UNKNOWN) return dType == DT_LNK;
+    struct stat st;
+    return ::fstatat(dirFd, name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISLNK(st.st_mode);
+}
+#endif
+#endif
+
+// Follows symlinks, like fs::is_directory and fs::last_write_time do.
+inline FileStat statPath(const fs::path& path) {
+#ifndef _WIN32
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0) return FileStat{};
+    return fromStat(st);
+#else
+    FileStat info;
+    std::error_code ec;
+    auto status = fs::status(path, ec);
+    if (ec || !fs::exists(status)) return info;
+    info.exists = true;
+    info.isDirectory = fs::is_directory(status);
+    auto ftime = fs::last_write_time(path, ec);
+    if (!ec) info.lastModified = toFileTime(ftime);
+    if (fs::is_regular_file(status)) {
+        auto size = fs::file_size(path, ec);
+        if (!ec) info.size = size;
+    }
+    return info;
+#endif
+}
+
+// Like statPath, but reports a symlink as itself instead of its target
+inline FileStat statNoFollow(const fs::path& path) {
+#ifndef _WIN32
+    struct stat st;
+    if (::lstat(path.c_str(), &st) != 0) return FileStat{};
+    FileStat info = fromStat(st);
+    info.isSymlink = S_ISLNK(st.st_mode);
+    return info;
+#else
+    std::error_code ec;
+    if (fs::is_symlink(fs::symlink_status(path, ec))) {
+        FileStat info;
+        info.exists = info.isSymlink = true;
+        return info;
+    }
+    return statPath(path);
+#endif
+}
+
+// Windows fills the directory_entry cache from FindNextFile, so reading it
+// there is free; on POSIX the cache only holds the type, so stat once.
+inline FileStat statEntry(const fs::directory_entry& entry) {
+#ifndef _WIN32
+    return statPath(entry.path());
+#else
+    FileStat info;
+    std::error_code ec;
+    if (!entry.exists(ec)) return info;
+    info.exists = true;
+    info.isDirectory = entry.is_directory(ec);
+    auto ftime = entry.last_write_time(ec);
+    if (!ec) info.lastModified = toFileTime(ftime);
+    if (entry.is_regular_file(ec)) {
+        auto size = entry.file_size(ec);
+        if (!ec) info.size = size;
+    }
+    return info;
+#endif
+}
+
+// ==================== Node Arena ====================
+class Node;
+
+// Owns the memory of a tree. Nodes and their child arrays are bump-allocated
+// from large slabs, so a scan does one allocation per slab instead of
+// several per entry, siblings end up next to each other, and dropping a tree
+// frees a handful of slabs instead of visiting every node (Nodes are
+// trivially destructible for that reason). Deleted nodes go on a free list
+// and their slots are reused; outgrown child arrays are reclaimed only with
+// the arena itself, i.e. on a full rebuild.
+// Not thread-safe: every scanner worker fills its own arena and the tree
+// adopts them once the scan is done.
+class NodeArena {
+public:
+    NodeArena() = default;
+    NodeArena(const NodeArena&) = delete;
+    NodeArena& operator=(const NodeArena&) = delete;
+    NodeArena(NodeArena&& other) noexcept { *this = std::move(other); }
+    ~NodeArena() { invalidatePaths(); }
+
+    NodeArena& operator=(NodeArena&& other) noexcept {
+        invalidatePaths();
+        slabs = std::move(other.slabs);
+        other.slabs.clear();
+        cursor = std::exchange(other.cursor, nullptr);
+        remaining = std::exchange(other.remaining, 0);
+        freeNodes = std::exchange(other.freeNodes, nullptr);
+        reserved = std::exchange(other.reserved, 0);
+        return *this;
+    }
+
+    void* allocate(size_t bytes, size_t align) {
+        size_t padding = (align - reinterpret_cast<uintptr_t>(cursor) % align) % align;
+        if (padding + bytes > remaining) {
+            if (bytes > slabSize / 4) return newSlab(bytes); // Keep filling the current slab
+            cursor = newSlab(slabSize);
+            remaining = slabSize;
+            padding = 0;
+        }
+        std::byte* result = cursor + padding;
+        cursor = result + bytes;
+        remaining -= padding + bytes;
+        return result;
+    }
+
+    // Copies text with a trailing NUL, so data() can go to C APIs as is
+    std::string_view copy(std::string_view text) {
+        char* chars = static_cast<char*>(allocate(text.size() + 1, 1));
+        std::memcpy(chars, text.data(), text.size());
+        chars[text.size()] = '\0';
+        return {chars, text.size()};
+    }
+
+    // Defined after Node
+    Node* makeRoot(const fs::path& path, int type, const FileStat& info);
+    Node* makeChild(Node* parent, std::string_view name, int type, const FileStat& info);
+    Node* makeChild(Node* parent, uint32_t nameId, int type, const FileStat& info);
+    void release(Node* subtree);
+
+    // Takes over the slabs of another arena (e.g. a scanner worker's)
+    void adopt(NodeArena&& other) {
+        for (auto& slab : other.slabs) slabs.push_back(std::move(slab));
+        reserved += other.reserved;
+        other.slabs.clear();
+        other.cursor = nullptr;
+        other.remaining = 0;
+        other.freeNodes = nullptr;
+        other.reserved = 0;
+    }
+
+    size_t bytesReserved() const { return reserved; }
+
+    // Bumped whenever a node may have been renamed, moved or freed, which
+    // drops the path cache of Node::pathString on every thread
+    static inline std::atomic<uint64_t> pathEpoch{0};
+    static void invalidatePaths() { pathEpoch.fetch_add(1, std::memory_order_relaxed); }
+
+private:
+    static constexpr size_t slabSize = 256 * 1024;
+
+    std::vector<std::unique_ptr<std::byte[]>> slabs;
+    std::byte* cursor = nullptr;
+    size_t remaining = 0;
+    void* freeNodes = nullptr; // singly linked through the free slots
+    size_t reserved = 0;
+
+    std::byte* newSlab(size_t bytes) {
+        slabs.emplace_back(new std::byte[bytes]);
+        reserved += bytes;
+        return slabs.back().get();
+    }
+
+    Node* newNode(Node* parent, uint32_t nameId, int type, const FileStat& info);
+};
+
+// ==================== Name Pool ====================
+// Every distinct file name is stored once for the whole process and Nodes
+// refer to it by id. Real trees repeat the same names (index.js, README.md,
+// .git, __init__.py) over and over, so repeats cost nothing, and two names
+// are equal exactly when their ids are, so lookups by name compare integers.
+// Interning is sharded by hash so scanner workers rarely contend on a lock;
+// reading a name takes none. Names are never removed.
+class NamePool {
+public:
+    using Id = uint32_t;
+    static constexpr unsigned idBits = 30; // Node keeps two flags next to the id
+
+    static NamePool& instance() {
+        static NamePool pool;
+        return pool;
+    }
+
+    NamePool() = default;
+    NamePool(const NamePool&) = delete;
+    NamePool& operator=(const NamePool&) = delete;
+
+    ~NamePool() {
+        for (Shard& shard : shards) {
+            for (auto& chunk : shard.chunks) delete[] chunk.load();
+        }
+    }
+
+    Id intern(std::string_view name) {
+        size_t hash = std::hash<std::string_view>{}(name);
+        size_t shardIndex = hash % shardCount;
+        Shard& shard = shards[shardIndex];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        Slot* slot = shard.find(name, hashBits(hash));
+        if (slot && slot->id != Slot::empty) return slot->id;
+
+        size_t index = shard.count;
+        if (index >= maxPerShard) throw std::length_error("too many distinct file names");
+        auto [chunkIndex, offset] = locate(index);
+        auto& chunkSlot = shard.chunks[chunkIndex];
+        std::string_view* chunk = chunkSlot.load(std::memory_order_relaxed);
+        if (!chunk) {
+            chunk = new std::string_view[firstChunk << chunkIndex];
+            chunkSlot.store(chunk, std::memory_order_release);
+        }
+        chunk[offset] = shard.bytes.copy(name); // NUL-terminated
+        ++shard.count;
+
+        Id id = static_cast<Id>(index * shardCount + shardIndex);
+        shard.insert(Slot{id, hashBits(hash)});
+        return id;
+    }
+
+    // Id of a name that is already in the pool, without adding it
+    bool lookup(std::string_view name, Id& id) {
+        size_t hash = std::hash<std::string_view>{}(name);
+        Shard& shard = shards[hash % shardCount];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        Slot* slot = shard.find(name, hashBits(hash));
+        if (!slot || slot->id == Slot::empty) return false;
+        id = slot->id;
+        return true;
+    }
+
+    std::string_view get(Id id) const {
+        auto [chunkIndex, offset] = locate(id / shardCount);
+        return shards[id % shardCount].chunks[chunkIndex].load(std::memory_order_acquire)[offset];
+    }
+
+private:
+    static constexpr size_t shardCount = 64;
+    static constexpr size_t maxPerShard = (size_t(1) << idBits) / shardCount;
+    // Chunk k holds firstChunk << k names, so a shard's storage grows
+    // geometrically and never moves
+    static constexpr size_t firstChunk = 256;
+    static constexpr size_t chunkCount = std::bit_width(maxPerShard / firstChunk);
+
+    static std::pair<size_t, size_t> locate(size_t index) {
+        size_t chunk = std::bit_width(index / firstChunk + 1) - 1;
+        return {chunk, index - firstChunk * ((size_t(1) << chunk) - 1)};
+    }
+
+    // Open-addressing hash table entry; the hash is kept for probing and
+    // rehashing so names are only compared on a full hash match
+    struct Slot {
+        static constexpr Id empty = UINT32_MAX;
+        Id id;
+        uint32_t hash;
+    };
+
+    static uint32_t hashBits(size_t hash) { return static_cast<uint32_t>(hash / shardCount); }
+
+    struct Shard {
+        std::mutex mutex;
+        std::vector<Slot> table; // power-of-two size, at most half full
+        NodeArena bytes;
+        size_t count = 0;
+        // Fixed table of chunks, so readers never see it move
+        std::atomic<std::string_view*> chunks[chunkCount] = {};
+
+        std::string_view name(Id id) const {
+            auto [chunkIndex, offset] = locate(id / shardCount);
+            return chunks[chunkIndex].load(std::memory_order_relaxed)[offset];
+        }
+
+        // The slot holding `text`, or the empty slot where it would go
+        Slot* find(std::string_view text, uint32_t hash) {
+            if (table.empty()) return nullptr;
+            size_t mask = table.size() - 1;
+            for (size_t i = hash & mask;; i = (i + 1) & mask) {
+                Slot& slot = table[i];
+                if (slot.id == Slot::empty) return &slot;
+                if (slot.hash == hash && name(slot.id) == text) return &slot;
+            }
+        }
+
+        void insert(Slot entry) {
+            if ((count + 1) * 2 > table.size()) {
+                std::vector<Slot> old(table.size() ? table.size() * 2 : 64, Slot{Slot::empty, 0});
+                old.swap(table);
+                for (const Slot& slot : old) {
+                    if (slot.id != Slot::empty) place(slot);
+                }
+            }
+            place(entry);
+        }
+
+        void place(Slot entry) {
+            size_t mask = table.size() - 1;
+            size_t i = entry.hash & mask;
+            while (table[i].id != Slot::empty) i = (i + 1) & mask;
+            table[i] = entry;
+        }
+    };
+    Shard shards[shardCount];
+};
+
+// What everything below a directory adds up to: bytes and number of files,
+// and the newest file modification time (0 without files)
+struct SubtreeTotals {
+    uint64_t bytes = 0;
+    uint64_t files = 0;
+    FileTime newest = 0;
+
+    void add(const SubtreeTotals& other) {
+        bytes += other.bytes;
+        files += other.files;
+        newest = std::max(newest, other.newest);
+    }
+};
+
+// A directory's children: Node pointers in arena memory, grown by doubling.
+// Count and capacity sit in front of the array, so an empty list (and
+// every file) costs a single null pointer. The directory's SubtreeTotals
+// live there too; a directory without files needs no header for them.
+class ChildList {
+public:
+    Node** begin() const { return block ? reinterpret_cast<Node**>(block + 1) : nullptr; }
+    Node** end() const { return block ? begin() + block->count : nullptr; }
+    size_t size() const { return block ? block->count : 0; }
+    bool empty() const { return size() == 0; }
+    Node* operator[](size_t i) const { return begin()[i]; }
+
+    void reserve(NodeArena& arena, size_t n) {
+        if (n <= capacity()) return;
+        grow(arena, n);
+    }
+
+    const SubtreeTotals& totals() const {
+        static const SubtreeTotals none;
+        return block ? block->totals : none;
+    }
+
+    void setTotals(NodeArena& arena, const SubtreeTotals& totals) {
+        if (!block) {
+            if (totals.files == 0) return;
+            grow(arena, 0);
+        }
+        block->totals = totals;
+    }
+
+    void assign(NodeArena& arena, const std::vector<Node*>& nodes) {
+        if (block) block->count = 0;
+        if (nodes.empty()) return;
+        reserve(arena, nodes.size());
+        std::copy(nodes.begin(), nodes.end(), begin());
+        block->count = static_cast<uint32_t>(nodes.size());
+    }
+
+    Node** insert(NodeArena& arena, Node** pos, Node* node) {
+        size_t offset = pos - begin();
+        if (size() == capacity()) reserve(arena, capacity() ? capacity() * 2 : 4);
+        std::copy_backward(begin() + offset, end(), end() + 1);
+        begin()[offset] = node;
+        ++block->count;
+        return begin() + offset;
+    }
+
+    void push_back(NodeArena& arena, Node* node) { insert(arena, end(), node); }
+
+    Node** erase(Node** first, Node** last) {
+        std::copy(last, end(), first);
+        if (block) block->count -= static_cast<uint32_t>(last - first);
+        return first;
+    }
+
+    Node** erase(Node** pos) { return erase(pos, pos + 1); }
+
+private:
+    struct alignas(Node*) Header {
+        uint32_t count;
+        uint32_t capacity;
+        SubtreeTotals totals;
+    };
+    Header* block = nullptr;
+
+    size_t capacity() const { return block ? block->capacity : 0; }
+
+    void grow(NodeArena& arena, size_t n) {
+        auto grown = static_cast<Header*>(
+            arena.allocate(sizeof(Header) + n * sizeof(Node*), alignof(Header)));
+        grown->count = static_cast<uint32_t>(size());
+        grown->capacity = static_cast<uint32_t>(n);
+        grown->totals = totals();
+        std::copy(begin(), end(), reinterpret_cast<Node**>(grown + 1));
+        block = grown;
+    }
+};
+
 // ==================== Improved Node Class ====================
+// Nodes live in a NodeArena (see above); create them with makeRoot or
+// makeChild. Paths are not stored: a node keeps its name and parent, and
+// the full path is rebuilt from the chain when needed.
 class Node {
 public:
-    enum Type { FILE, DIRECTORY };
+    enum Type : uint32_t { FILE, DIRECTORY };
+
+    // Fields are ordered to pack into 40 bytes on 64-bit targets
+    Node* parent;        // nullptr for the root
+    ChildList children;
+    FileTime lastModified;
+
+private:
+    uint64_t sizeOrInode; // files: size in bytes, directories: inode
+
+public:
+    // Position in the mapped snapshot this node was loaded from, if any. A
+    // lazy directory's children have not been materialized yet and are read
+    // from the snapshot instead (see FileSystemTree::ensureLoaded).
+    static constexpr uint32_t noSnapshot = UINT32_MAX;
+    uint32_t snapshotIndex = noSnapshot;
 
-    std::string name;
-    Type type;
-    fs::path fullPath;
-    std::vector<std::unique_ptr<Node>> children;
-    time_t lastModified;
-    uintmax_t size; // in bytes
+    NamePool::Id nameId : NamePool::idBits; // a root's name is its full path
+    Type type : 1;
+    uint32_t lazy : 1 = 0;
 
-    Node(const std::string& name, const fs::path& path, Type t = FILE)
-        : name(name), type(t), fullPath(path) {
-        updateFileInfo();
+    Node(Node* parent, NamePool::Id name, Type t, const FileStat& info)
+        : parent(parent), lastModified(0), sizeOrInode(0), nameId(name), type(t) {
+        setInfo(info);
     }
 
+    std::string_view name() const {
+        std::string_view text = NamePool::instance().get(nameId);
+        if (parent) return text;
+        size_t slash = text.find_last_of(separators);
+        return slash == std::string_view::npos ? text : text.substr(slash + 1);
+    }
+
+    void rename(std::string_view newName) {
+        nameId = NamePool::instance().intern(newName);
+        NodeArena::invalidatePaths();
+    }
+
+    // Directories report 0, like the scanner always did
+    uintmax_t size() const { return type == FILE ? sizeOrInode : 0; }
+    // Only tracked for directories (it is what Refresh Tree compares)
+    uint64_t inode() const { return type == DIRECTORY ? sizeOrInode : 0; }
+
+    void setInfo(const FileStat& info) {
+        lastModified = info.lastModified;
+        sizeOrInode = type == DIRECTORY ? info.inode : info.size;
+    }
+
+    FileStat info() const {
+        FileStat stat;
+        stat.exists = true;
+        stat.isDirectory = type == DIRECTORY;
+        stat.lastModified = lastModified;
+        stat.size = size();
+        stat.inode = inode();
+        return stat;
+    }
+
+    std::string pathString() const;
+    fs::path path() const { return fs::path(pathString()); }
+
+    // Re-reads size and modification time from disk
     void updateFileInfo() {
         try {
-            if (fs::exists(fullPath)) {
-                // Correct way to convert fs::file_time_type to time_t
-                auto ftime = fs::last_write_time(fullPath);
-                
-                // Cast to system_clock::time_point and then convert
-                auto sctime = std::chrono::file_clock::to_sys(ftime);
-                lastModified = std::chrono::system_clock::to_time_t(sctime);
-
-                size = type == DIRECTORY ? 0 : fs::file_size(fullPath);
-            } else {
-                lastModified = 0; // Or some indicator for non-existent
-                size = 0;
-            }
-        } catch (const fs::filesystem_error& e) {
-            std::cerr << "Filesystem error updating info for " << fullPath << ": " << e.what() << "\n";
-            lastModified = 0;
-            size = 0;
+            FileStat info = statPath(path());
+            setInfo(info); // Zeroed if the path does not exist
         } catch (const std::exception& e) {
-            std::cerr << "General error updating info for " << fullPath << ": " << e.what() << "\n";
-            lastModified = 0;
-            size = 0;
+            std::cerr << "General error updating info for " << path() << ": " << e.what() << "\n";
+            setInfo(FileStat{});
+        }
+    }
+
+    static bool byName(const Node* a, const Node* b) { return a->name() < b->name(); }
+
+    // Same order as sorting with byName, but each name is fetched once
+    static void sortByName(std::vector<Node*>& nodes) {
+        std::vector<std::pair<std::string_view, Node*>> keyed;
+        keyed.reserve(nodes.size());
+        for (Node* node : nodes) keyed.emplace_back(node->name(), node);
+        std::sort(keyed.begin(), keyed.end(),
+            [](const auto& a, const auto& b) { return a.first < b.first; });
+        for (size_t i = 0; i < nodes.size(); ++i) nodes[i] = keyed[i].second;
+    }
+
+    // For a directory, size and files are those of everything below it
+    static void printLine(int indent, bool isDirectory, std::string_view name,
+                          uintmax_t size, FileTime lastModified, bool showDetails, uint64_t files = 0) {
+        std::cout << std::string(indent * 2, ' ')
+                  << (isDirectory ? "📁 " : "📄 ")
+                  << name;
+
+        if (showDetails) {
+            std::cout << "  " << formatSize(size);
+            if (isDirectory) std::cout << " in " << files << (files == 1 ? " file" : " files") << ", newest";
+            std::cout << (isDirectory ? " " : "  ") << formatTime(toSeconds(lastModified));
+        }
+
+        std::cout << "\n";
+    }
+
+    static std::string formatSize(uintmax_t bytes) {
+        constexpr const char* sizes[] = {"B", "KB", "MB", "GB"};
+        double size = bytes;
+        int i = 0;
+        while (size >= 1024 && i < 3) {
+            size /= 1024;
+            i++;
+        }
+        std::ostringstream oss;
+        oss << std::fixed << std::setprecision(2) << size << sizes[i];
+        return oss.str();
+    }
+
+    static std::string formatTime(time_t time) {
+        char buffer[80];
+        std::strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", std::localtime(&time));
+        return buffer;
+    }
+
+private:
+#ifdef _WIN32
+    static constexpr const char* separators = "/\\";
+#else
+    static constexpr const char* separators = "/";
+#endif
+};
+
+static_assert(std::is_trivially_destructible_v<Node>, "NodeArena never runs Node destructors");
+static_assert(sizeof(Node) <= 40, "Node should stay within 40 bytes");
+
+// Builds the path from the names up the parent chain. Each thread remembers
+// the last directory it resolved, so siblings and descendants of it (a
+// directory listing, consecutive search results) only append their own
+// names instead of walking up to the root.
+inline std::string Node::pathString() const {
+    struct PathCache {
+        const Node* dir = nullptr;
+        uint64_t epoch = 0;
+        std::string path;
+        std::vector<const Node*> chain;
+    };
+    static thread_local PathCache cache;
+
+    uint64_t epoch = NodeArena::pathEpoch.load(std::memory_order_relaxed);
+    if (cache.epoch != epoch) {
+        cache.dir = nullptr;
+        cache.epoch = epoch;
+    }
+
+    auto& chain = cache.chain;
+    chain.clear();
+    const Node* node = this;
+    for (; node && node != cache.dir; node = node->parent) chain.push_back(node);
+
+    std::string result = node ? cache.path : std::string();
+    size_t parentLength = result.size();
+    for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+        parentLength = result.size();
+        if (!result.empty() && std::strchr(separators, result.back()) == nullptr) {
+            result += static_cast<char>(fs::path::preferred_separator);
+        }
+        result += NamePool::instance().get((*it)->nameId);
+    }
+
+    if (type == DIRECTORY && cache.dir != this) {
+        cache.dir = this;
+        cache.path = result;
+    } else if (type == FILE && parent && cache.dir != parent) {
+        cache.dir = parent;
+        cache.path.assign(result, 0, parentLength);
+    }
+    return result;
+}
+
+inline Node* NodeArena::newNode(Node* parent, uint32_t nameId, int type,
+                                const FileStat& info) {
+    void* slot = freeNodes;
+    if (slot) {
+        freeNodes = *static_cast<void**>(slot);
+    } else {
+        slot = allocate(sizeof(Node), alignof(Node));
+    }
+    return new (slot) Node(parent, nameId, static_cast<Node::Type>(type), info);
+}
+
+// The root of a tree; it keeps its whole path as its name
+inline Node* NodeArena::makeRoot(const fs::path& path, int type, const FileStat& info) {
+    return newNode(nullptr, NamePool::instance().intern(path.string()), type, info);
+}
+
+// Node for the entry `name` inside parent (not added to parent->children)
+inline Node* NodeArena::makeChild(Node* parent, std::string_view name, int type,
+                                  const FileStat& info) {
+    return newNode(parent, NamePool::instance().intern(name), type, info);
+}
+
+inline Node* NodeArena::makeChild(Node* parent, uint32_t nameId, int type,
+                                  const FileStat& info) {
+    return newNode(parent, nameId, type, info);
+}
+
+// Puts every node of the subtree on the free list
+inline void NodeArena::release(Node* subtree) {
+    invalidatePaths();
+    std::vector<Node*> stack{subtree};
+    while (!stack.empty()) {
+        Node* node = stack.back();
+        stack.pop_back();
+        stack.insert(stack.end(), node->children.begin(), node->children.end());
+        *reinterpret_cast<void**>(node) = freeNodes;
+        freeNodes = node;
+    }
+}
+
+// Root node of a scan: a tree root, or a subtree root under `parent`
+inline Node* makeScanRoot(const fs::path& path, NodeArena& into, Node* parent, const FileStat& info) {
+    Node::Type type = info.isDirectory ? Node::DIRECTORY : Node::FILE;
+    return parent ? into.makeChild(parent, path.filename().string(), type, info)
+                  : into.makeRoot(path, type, info);
+}
+
+// ==================== Parallel Directory Scanner ====================
+// Builds the Node hierarchy for a directory using a pool of worker threads.
+// Every worker owns a deque of directories waiting to be listed: it pops from
+// the back of its own deque (depth first) and, when that runs dry, steals from
+// the front of another worker's deque (the oldest, usually largest subtrees).
+// Children are sorted by name so the result does not depend on scheduling.
+// Symlinked directories are listed but not descended into, so link cycles
+// (e.g. /usr/bin/X11 -> .) cannot make the scan run forever.
+// On Linux directories are read with raw getdents64 into a large per-worker
+// buffer and each entry is stat'ed with statx relative to the directory fd;
+// other platforms use std::filesystem::directory_iterator.
+class ParallelScanner {
+public:
+    explicit ParallelScanner(unsigned workers = 0, bool showProgress = true)
+        : workerCount(workers ? workers : defaultWorkers()), queues(workerCount),
+          progressEnabled(showProgress) {}
+
+    static unsigned defaultWorkers() {
+        unsigned n = std::thread::hardware_concurrency();
+        return n ? n : 1;
+    }
+
+    // Lists a single directory into dir->children (sorted) without
+    // descending; subdirs receives the children that a scan would enter.
+    // The new Nodes live in the scanner's own arena, so they are only valid
+    // as long as the scanner is.
+    void listChildren(Node* dir, std::vector<Node*>& subdirs) {
+        listInto(dir, 0, subdirs);
+    }
+
+    // Nodes are allocated in per-worker arenas that `into` adopts at the
+    // end. With a parent the result is a subtree of it (but not yet one of
+    // its children), otherwise a new root.
+    Node* scan(const fs::path& rootPath, NodeArena& into, Node* parent = nullptr) {
+        FileStat info = statPath(rootPath);
+        Node* root = makeScanRoot(rootPath, into, parent, info);
+        if (!info.isDirectory) return root;
+
+        itemCount = 0;
+        pending = 1;
+        queues[0].tasks.push_back(root);
+        startTime = std::chrono::steady_clock::now();
+
+        std::vector<std::thread> threads;
+        for (unsigned i = 1; i < workerCount; ++i) {
+            threads.emplace_back(&ParallelScanner::workerLoop, this, i);
+        }
+        workerLoop(0); // The calling thread works too and reports progress
+        for (auto& t : threads) {
+            t.join();
+        }
+        for (auto& arena : arenas) {
+            into.adopt(std::move(arena));
+        }
+
+        if (progressShown) {
+            std::cout << "\r" << std::string(50, ' ') << "\r"; // Clear line
+        }
+        return root;
+    }
+
+private:
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<Node*> tasks;
+    };
+
+    unsigned workerCount;
+    std::vector<WorkQueue> queues;
+    std::atomic<size_t> pending{0};   // directories queued or being listed
+    std::atomic<size_t> itemCount{0};
+    std::chrono::steady_clock::time_point startTime, lastProgress;
+    bool progressEnabled;
+    bool progressShown = false;
+    std::vector<NodeArena> arenas{workerCount}; // one per worker
+#ifdef FSM_HAVE_GETDENTS
+    static constexpr size_t direntBufferSize = 128 * 1024;
+    std::vector<std::vector<char>> direntBuffers{workerCount}; // one per worker
+#endif
+
+    Node* popLocal(unsigned id) {
+        std::lock_guard<std::mutex> lock(queues[id].mutex);
+        if (queues[id].tasks.empty()) return nullptr;
+        Node* dir = queues[id].tasks.back();
+        queues[id].tasks.pop_back();
+        return dir;
+    }
+
+    Node* steal(unsigned thief) {
+        for (unsigned i = 1; i < workerCount; ++i) {
+            WorkQueue& victim = queues[(thief + i) % workerCount];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                Node* dir = victim.tasks.front();
+                victim.tasks.pop_front();
+                return dir;
+            }
+        }
+        return nullptr;
+    }
+
+    void workerLoop(unsigned id) {
+        int idleRounds = 0;
+        while (pending.load() > 0) {
+            Node* dir = popLocal(id);
+            if (!dir) dir = steal(id);
+
+            if (!dir) {
+                // Nothing to do right now, but other workers may still
+                // discover subdirectories; back off gently.
+                if (++idleRounds < 64) {
+                    std::this_thread::yield();
+                } else {
+                    std::this_thread::sleep_for(std::chrono::microseconds(200));
+                }
+                continue;
+            }
+
+            idleRounds = 0;
+            listDirectory(dir, id);
+            pending.fetch_sub(1);
+
+            if (id == 0 && progressEnabled) showProgress();
+        }
+    }
+
+    // Enumerates dir into worker id's arena and stores the sorted children
+    void listInto(Node* dir, unsigned id, std::vector<Node*>& subdirs) {
+        std::vector<Node*> entries;
+#ifdef FSM_HAVE_GETDENTS
+        enumerateLinux(dir, id, entries, subdirs);
+#else
+        enumeratePortable(dir, id, entries, subdirs);
+#endif
+        Node::sortByName(entries);
+        dir->children.assign(arenas[id], entries);
+    }
+
+    void listDirectory(Node* dir, unsigned id) {
+        std::vector<Node*> subdirs;
+        listInto(dir, id, subdirs);
+        std::sort(subdirs.begin(), subdirs.end(), Node::byName);
+
+        itemCount += dir->children.size();
+
+        if (!subdirs.empty()) {
+            pending += subdirs.size();
+            std::lock_guard<std::mutex> lock(queues[id].mutex);
+            // Push in reverse so the owner pops them back in name order
+            for (auto it = subdirs.rbegin(); it != subdirs.rend(); ++it) {
+                queues[id].tasks.push_back(*it);
+            }
+        }
+    }
+
+    void enumeratePortable(Node* dir, unsigned id, std::vector<Node*>& entries,
+                           std::vector<Node*>& subdirs) {
+        try {
+            std::error_code ec;
+            fs::directory_iterator it(dir->path(), ec);
+            if (ec) {
+                std::cerr << "Error building tree for: " << dir->path()
+                          << ": " << ec.message() << "\n";
+                return;
+            }
+
+            for (; it != fs::directory_iterator(); it.increment(ec)) {
+                if (ec) break;
+                try {
+                    const auto& entry = *it;
+                    FileStat info = statEntry(entry);
+                    bool isDir = info.isDirectory;
+                    Node* child = arenas[id].makeChild(dir, entry.path().filename().string(),
+                        isDir ? Node::DIRECTORY : Node::FILE, info);
+                    std::error_code typeEc; // is_symlink reads the cached d_type
+                    if (isDir && !entry.is_symlink(typeEc)) {
+                        subdirs.push_back(child);
+                    }
+                    entries.push_back(child);
+                } catch (...) {
+                    continue; // Skip problematic entries
+                }
+            }
+        } catch (...) {
+            std::cerr << "Error building tree for: " << dir->path() << "\n";
+        }
+    }
+
+#ifdef FSM_HAVE_GETDENTS
+    void enumerateLinux(Node* dir, unsigned id, std::vector<Node*>& entries,
+                        std::vector<Node*>& subdirs) {
+        int fd = ::open(dir->pathString().c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0) {
+            std::error_code ec(errno, std::generic_category());
+            std::cerr << "Error building tree for: " << dir->path()
+                      << ": " << ec.message() << "\n";
+            return;
+        }
+
+        auto& buffer = direntBuffers[id];
+        if (buffer.empty()) buffer.resize(direntBufferSize);
+
+        bool ok = readDirents(fd, buffer, [&](const char* name, unsigned char dType) {
+            try {
+                FileStat info = statAt(fd, name, dType);
+                bool isDir = info.isDirectory;
+                Node* child = arenas[id].makeChild(dir, name,
+                    isDir ? Node::DIRECTORY : Node::FILE, info);
+                if (isDir && !isSymlinkAt(fd, name, dType)) {
+                    subdirs.push_back(child);
+                }
+                entries.push_back(child);
+            } catch (...) {
+                // Skip problematic entries
+            }
+        });
+        if (!ok) {
+            std::error_code ec(errno, std::generic_category());
+            std::cerr << "Error reading directory " << dir->path()
+                      << ": " << ec.message() << "\n";
+        }
+
+        ::close(fd);
+    }
+#endif
+
+    void showProgress() {
+        size_t count = itemCount.load();
+        if (count < 100) return;
+
+        auto now = std::chrono::steady_clock::now();
+        if (now - lastProgress < std::chrono::milliseconds(100)) return;
+        lastProgress = now;
+
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - startTime).count();
+        std::cout << "\rLoading... " << count << " items ("
+                  << elapsed << "ms, " << workerCount << " threads)";
+        std::cout.flush();
+        progressShown = true;
+    }
+};
+
+#ifdef FSM_HAVE_IO_URING
+// ==================== io_uring Scanner ====================
+// Minimal io_uring wrapper over the raw syscalls (no liburing dependency).
+// Only what the scanner needs: grab an SQE, submit-and-wait, reap CQEs.
+class IoUring {
+public:
+    IoUring() = default;
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    ~IoUring() {
+        if (sqes) ::munmap(sqes, sqesSize);
+        if (cqRing && cqRing != sqRing) ::munmap(cqRing, cqRingSize);
+        if (sqRing) ::munmap(sqRing, sqRingSize);
+        if (ringFd >= 0) ::close(ringFd);
+    }
+
+    bool init(unsigned entries) {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        ringFd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+        if (ringFd < 0) return false;
+
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (singleMmap) sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+
+        sqRing = mapRing(sqRingSize, IORING_OFF_SQ_RING);
+        if (!sqRing) return false;
+        cqRing = singleMmap ? sqRing : mapRing(cqRingSize, IORING_OFF_CQ_RING);
+        if (!cqRing) return false;
+        sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = static_cast<io_uring_sqe*>(mapRing(sqesSize, IORING_OFF_SQES));
+        if (!sqes) return false;
+
+        char* sq = static_cast<char*>(sqRing);
+        sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        sqEntries = params.sq_entries;
+        localTail = *sqTail;
+
+        char* cq = static_cast<char*>(cqRing);
+        cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        return true;
+    }
+
+    unsigned capacity() const { return sqEntries; }
+
+    // True if the running kernel implements every listed opcode
+    bool supports(std::initializer_list<int> opcodes) {
+        const unsigned maxOps = 256;
+        std::vector<char> buffer(sizeof(io_uring_probe) + maxOps * sizeof(io_uring_probe_op), 0);
+        auto* probe = reinterpret_cast<io_uring_probe*>(buffer.data());
+        if (::syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_PROBE, probe, maxOps) < 0) {
+            return false; // Probing itself needs 5.6+
+        }
+        for (int op : opcodes) {
+            if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Next free submission slot, zeroed, or nullptr if the queue is full
+    io_uring_sqe* getSqe() {
+        unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+        if (localTail - head >= sqEntries) return nullptr;
+        unsigned index = localTail & sqMask;
+        sqArray[index] = index;
+        ++localTail;
+        ++unsubmitted;
+        std::memset(&sqes[index], 0, sizeof(io_uring_sqe));
+        return &sqes[index];
+    }
+
+    int submitAndWait(unsigned waitFor) {
+        __atomic_store_n(sqTail, localTail, __ATOMIC_RELEASE);
+        unsigned flags = waitFor ? IORING_ENTER_GETEVENTS : 0;
+        long ret;
+        do {
+            ret = ::syscall(__NR_io_uring_enter, ringFd, unsubmitted, waitFor, flags, nullptr, 0);
+        } while (ret < 0 && errno == EINTR);
+        if (ret > 0) unsubmitted -= std::min<unsigned>(unsubmitted, static_cast<unsigned>(ret));
+        return static_cast<int>(ret);
+    }
+
+    // Calls onComplete(user_data, res) for every completion available now
+    template <typename Callback>
+    void reap(Callback&& onComplete) {
+        unsigned head = *cqHead;
+        unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+            const io_uring_cqe& cqe = cqes[head & cqMask];
+            onComplete(cqe.user_data, cqe.res);
+            ++head;
+        }
+        __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+    }
+
+private:
+    int ringFd = -1;
+    void* sqRing = nullptr;
+    void* cqRing = nullptr;
+    size_t sqRingSize = 0, cqRingSize = 0, sqesSize = 0;
+    io_uring_sqe* sqes = nullptr;
+    unsigned *sqHead = nullptr, *sqTail = nullptr, *sqArray = nullptr;
+    unsigned sqMask = 0, sqEntries = 0, localTail = 0, unsubmitted = 0;
+    unsigned *cqHead = nullptr, *cqTail = nullptr;
+    unsigned cqMask = 0;
+    io_uring_cqe* cqes = nullptr;
+
+    void* mapRing(size_t size, off_t offset) {
+        void* ptr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_POPULATE, ringFd, offset);
+        return ptr == MAP_FAILED ? nullptr : ptr;
+    }
+};
+
+// Builds the same Node hierarchy as ParallelScanner from a single thread that
+// keeps a deep queue of IORING_OP_OPENAT (directories) and IORING_OP_STATX
+// (entries) requests in flight. Directory contents are still read with
+// getdents64, which io_uring has no opcode for. Nodes are created with their
+// d_type when the directory is read and completed as their statx arrives.
+class UringScanner {
+public:
+    static constexpr unsigned queueDepth = 512;
+
+    explicit UringScanner(bool showProgress = true) : progressEnabled(showProgress) {}
+
+    // io_uring may be compiled in but disabled (old kernel, seccomp, sysctl)
+    static bool available() {
+        IoUring ring;
+        return ring.init(8) && ring.supports({IORING_OP_OPENAT, IORING_OP_STATX});
+    }
+
+    // See ParallelScanner::scan
+    Node* scan(const fs::path& rootPath, NodeArena& into, Node* parent = nullptr) {
+        FileStat info = statPath(rootPath);
+        Node* root = makeScanRoot(rootPath, into, parent, info);
+        if (!info.isDirectory) return root;
+
+        arena = &into;
+
+        if (!ring.init(queueDepth)) {
+            throw std::runtime_error("io_uring_setup failed");
+        }
+        direntBuffer.resize(128 * 1024);
+        startTime = std::chrono::steady_clock::now();
+
+        openQueue.push_back(newOp(Op::OPEN, nullptr, root, DT_DIR));
+        while (inFlight > 0 || !statQueue.empty() || !openQueue.empty()) {
+            fillQueue();
+            if (ring.submitAndWait(inFlight ? 1 : 0) < 0 && errno != EBUSY) {
+                throw std::runtime_error("io_uring_enter failed");
+            }
+            ring.reap([this](uint64_t userData, int res) {
+                --inFlight;
+                complete(reinterpret_cast<Op*>(userData), res);
+            });
+            if (progressEnabled) showProgress();
+        }
+
+        if (progressShown) {
+            std::cout << "\r" << std::string(50, ' ') << "\r"; // Clear line
+        }
+        return root;
+    }
+
+private:
+    // A directory whose fd stays open until all its entries are stat'ed
+    struct OpenDir {
+        Node* node;
+        int fd;
+        size_t pendingStats;
+    };
+
+    struct Op {
+        enum Kind { OPEN, STAT } kind;
+        OpenDir* parent;   // directory the entry was read from (STAT)
+        Node* node;        // directory to open, or entry to stat
+        std::string path;  // directory path (OPEN)
+        unsigned char dType;
+        struct statx stx;
+    };
+
+    IoUring ring;
+    NodeArena* arena = nullptr;
+    unsigned inFlight = 0;
+    std::deque<Op*> statQueue;  // drained first so open fds stay bounded
+    std::deque<Op*> openQueue;
+    std::deque<Op> opStorage;
+    std::vector<Op*> freeOps;
+    std::deque<OpenDir> dirStorage;
+    std::vector<OpenDir*> freeDirs;
+    std::vector<char> direntBuffer;
+    size_t itemCount = 0;
+    std::chrono::steady_clock::time_point startTime, lastProgress;
+    bool progressEnabled;
+    bool progressShown = false;
+
+    Op* newOp(Op::Kind kind, OpenDir* parent, Node* node, unsigned char dType) {
+        Op* op;
+        if (freeOps.empty()) {
+            opStorage.emplace_back();
+            op = &opStorage.back();
+        } else {
+            op = freeOps.back();
+            freeOps.pop_back();
+        }
+        op->kind = kind;
+        op->parent = parent;
+        op->node = node;
+        op->dType = dType;
+        return op;
+    }
+
+    void fillQueue() {
+        while (inFlight < ring.capacity() && (!statQueue.empty() || !openQueue.empty())) {
+            io_uring_sqe* sqe = ring.getSqe();
+            if (!sqe) break;
+
+            auto& queue = statQueue.empty() ? openQueue : statQueue;
+            Op* op = queue.front();
+            queue.pop_front();
+
+            if (op->kind == Op::OPEN) {
+                sqe->opcode = IORING_OP_OPENAT;
+                sqe->fd = AT_FDCWD;
+                op->path = op->node->pathString(); // Must outlive the request
+                sqe->addr = reinterpret_cast<uint64_t>(op->path.c_str());
+                sqe->open_flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+            } else {
+                sqe->opcode = IORING_OP_STATX;
+                sqe->fd = op->parent->fd;
+                sqe->addr = reinterpret_cast<uint64_t>(op->node->name().data());
+                sqe->len = statxMask(op->dType);
+                sqe->off = reinterpret_cast<uint64_t>(&op->stx);
+                sqe->statx_flags = 0;
+            }
+            sqe->user_data = reinterpret_cast<uint64_t>(op);
+            ++inFlight;
+        }
+    }
+
+    void complete(Op* op, int res) {
+        if (op->kind == Op::OPEN) {
+            if (res < 0) {
+                std::cerr << "Error building tree for: " << op->node->path()
+                          << ": " << std::error_code(-res, std::generic_category()).message() << "\n";
+            } else {
+                readDirectory(op->node, res);
+            }
+        } else {
+            finishEntry(op, res);
+        }
+        freeOps.push_back(op);
+    }
+
+    void readDirectory(Node* dir, int fd) {
+        OpenDir* open;
+        if (freeDirs.empty()) {
+            dirStorage.push_back(OpenDir{});
+            open = &dirStorage.back();
+        } else {
+            open = freeDirs.back();
+            freeDirs.pop_back();
+        }
+        *open = OpenDir{dir, fd, 0};
+
+        std::vector<Node*> entries;
+        bool ok = readDirents(fd, direntBuffer, [&](const char* name, unsigned char dType) {
+            try {
+                Node* child = arena->makeChild(dir, name,
+                    dType == DT_DIR ? Node::DIRECTORY : Node::FILE, FileStat{});
+                statQueue.push_back(newOp(Op::STAT, open, child, dType));
+                ++open->pendingStats;
+                entries.push_back(child);
+            } catch (...) {
+                // Skip problematic entries
+            }
+        });
+        if (!ok) {
+            std::error_code ec(errno, std::generic_category());
+            std::cerr << "Error reading directory " << dir->path()
+                      << ": " << ec.message() << "\n";
+        }
+
+        // Only names are known yet, which is all the ordering needs
+        Node::sortByName(entries);
+        dir->children.assign(*arena, entries);
+        itemCount += dir->children.size();
+
+        if (open->pendingStats == 0) closeDir(open);
+    }
+
+    void finishEntry(Op* op, int res) {
+        Node* node = op->node;
+        OpenDir* parent = op->parent;
+
+        FileStat info; // Missing targets (dangling symlinks) stay zeroed
+        if (res == 0) {
+            info = fromStatx(op->stx);
+        } else if (res == -EINVAL || res == -ENOSYS) {
+            info = statAt(parent->fd, node->name().data(), op->dType);
+        }
+        node->type = info.isDirectory ? Node::DIRECTORY : Node::FILE;
+        node->setInfo(info);
+
+        if (info.isDirectory && !isSymlinkAt(parent->fd, node->name().data(), op->dType)) {
+            openQueue.push_back(newOp(Op::OPEN, nullptr, node, DT_DIR));
+        }
+
+        if (--parent->pendingStats == 0) closeDir(parent);
+    }
+
+    void closeDir(OpenDir* open) {
+        ::close(open->fd);
+        freeDirs.push_back(open);
+    }
+
+    void showProgress() {
+        if (itemCount < 100) return;
+        auto now = std::chrono::steady_clock::now();
+        if (now - lastProgress < std::chrono::milliseconds(100)) return;
+        lastProgress = now;
+
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - startTime).count();
+        std::cout << "\rLoading... " << itemCount << " items ("
+                  << elapsed << "ms, io_uring)";
+        std::cout.flush();
+        progressShown = true;
+    }
+};
+#endif
+
+// ==================== Tree Snapshot ====================
+// Flat, offset-based copy of a tree that is memory-mapped on startup and
+// browsed in place: nothing is deserialized, and processes opening the same
+// snapshot share one page-cache copy. Layout (native byte order, checked via
+// byteOrderMark):
+//   SnapshotHeader
+//   SnapshotRecord[nodeCount]   pre-order, so a node's descendants are the
+//                               records [index + 1, subtreeEnd)
+//   name table                  root path followed by every node's name
+struct SnapshotHeader {
+    char magic[7];
+    uint8_t version;
+    uint32_t byteOrderMark;
+    uint32_t recordSize;
+    uint64_t nodeCount;
+    uint64_t recordsOffset;
+    uint64_t namesOffset;
+    uint64_t namesSize;
+    uint32_t rootPathLength; // root path is at the start of the name table
+    uint32_t reserved;
+};
+
+struct SnapshotRecord {
+    uint64_t size;
+    FileTime lastModified;
+    uint64_t inode;
+    uint32_t nameOffset;     // into the name table
+    uint32_t subtreeEnd;     // index one past the last descendant
+    uint32_t childCount;
+    uint16_t nameLength;
+    uint8_t type;            // Node::Type
+    uint8_t reserved;
+};
+
+// ==================== Mapped File ====================
+// A whole file mapped read-only; empty files are never mapped
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+#ifdef _WIN32
+        if (base) UnmapViewOfFile(base);
+        if (mapping) CloseHandle(mapping);
+#else
+        if (base) ::munmap(const_cast<char*>(base), length);
+#endif
+    }
+
+    const char* data() const { return base; }
+    size_t size() const { return length; }
+
+    // Adds madvise(MADV_SEQUENTIAL) where available, for single-pass reads
+    bool map(const fs::path& file, bool sequential = false) {
+#ifdef _WIN32
+        (void)sequential;
+        HANDLE handle = CreateFileW(file.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE,
+                                    nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (handle == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER fileSize;
+        if (GetFileSizeEx(handle, &fileSize) && fileSize.QuadPart > 0) {
+            length = static_cast<size_t>(fileSize.QuadPart);
+            mapping = CreateFileMappingW(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        }
+        CloseHandle(handle); // The mapping keeps the file open
+        if (!mapping) return false;
+        base = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+#else
+        // O_NONBLOCK so that a FIFO cannot hang the open; it is not mapped
+        int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+        if (fd < 0) return false;
+        struct stat st;
+        if (::fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+            length = static_cast<size_t>(st.st_size);
+            void* ptr = ::mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+            if (ptr != MAP_FAILED) {
+                base = static_cast<const char*>(ptr);
+                if (sequential) ::madvise(ptr, length, MADV_SEQUENTIAL);
+            }
+        }
+        ::close(fd); // The mapping keeps the file open
+#endif
+        return base != nullptr;
+    }
+
+private:
+    const char* base = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    HANDLE mapping = nullptr;
+#endif
+};
+
+// Read-only view over a mapped snapshot file
+class MappedSnapshot {
+public:
+    static constexpr char magic[7] = {'F', 'S', 'M', 'S', 'N', 'A', 'P'};
+    static constexpr uint8_t version = 4;
+    static constexpr uint32_t byteOrderMark = 0x01020304;
+    static constexpr uint32_t npos = UINT32_MAX;
+
+    MappedSnapshot() = default;
+    MappedSnapshot(const MappedSnapshot&) = delete;
+    MappedSnapshot& operator=(const MappedSnapshot&) = delete;
+
+    // Maps the file and checks it belongs to rootPath; nullptr on any problem
+    static std::unique_ptr<MappedSnapshot> open(const fs::path& file, const fs::path& rootPath) {
+        auto view = std::make_unique<MappedSnapshot>();
+        if (!view->mapped.map(file) || !view->validate(rootPath)) return nullptr;
+        return view;
+    }
+
+    uint32_t size() const { return static_cast<uint32_t>(header->nodeCount); }
+    const SnapshotRecord& record(uint32_t index) const { return records[index]; }
+    std::string_view name(uint32_t index) const {
+        return std::string_view(names + records[index].nameOffset, records[index].nameLength);
+    }
+    bool isDirectory(uint32_t index) const { return records[index].type == Node::DIRECTORY; }
+    uint32_t end(uint32_t index) const { return records[index].subtreeEnd; }
+
+    FileStat info(uint32_t index) const {
+        FileStat info;
+        info.exists = true;
+        info.isDirectory = isDirectory(index);
+        info.size = records[index].size;
+        info.lastModified = records[index].lastModified;
+        info.inode = records[index].inode;
+        return info;
+    }
+
+    // Sums the files below a directory record. Its descendants are the
+    // records up to end(index), so this is one scan of that range.
+    SubtreeTotals totals(uint32_t index) const {
+        SubtreeTotals sum;
+        for (uint32_t i = index + 1; i < end(index); ++i) {
+            if (isDirectory(i)) continue;
+            sum.bytes += records[i].size;
+            ++sum.files;
+            sum.newest = std::max(sum.newest, records[i].lastModified);
+        }
+        return sum;
+    }
+
+    // Prints the descendants of index as Node::printLine would, in order
+    void printSubtree(uint32_t index, int indent, bool showDetails) const {
+        std::vector<uint32_t> openEnds; // subtreeEnd of each ancestor being printed
+        for (uint32_t i = index + 1; i < end(index); ++i) {
+            while (!openEnds.empty() && i >= openEnds.back()) openEnds.pop_back();
+            const SnapshotRecord& rec = records[i];
+            bool directory = rec.type == Node::DIRECTORY;
+            SubtreeTotals below = directory && showDetails ? totals(i) : SubtreeTotals{};
+            Node::printLine(indent + static_cast<int>(openEnds.size()), directory, name(i),
+                            directory ? below.bytes : rec.size,
+                            std::max(rec.lastModified, below.newest),
+                            showDetails, below.files);
+            openEnds.push_back(rec.subtreeEnd);
+        }
+    }
+
+    // First descendant of index (pre-order) with the given name, or npos
+    uint32_t findInSubtree(uint32_t index, std::string_view targetName) const {
+        for (uint32_t i = index + 1; i < end(index); ++i) {
+            if (name(i) == targetName) return i;
+        }
+        return npos;
+    }
+
+private:
+    MappedFile mapped;
+    const SnapshotHeader* header = nullptr;
+    const SnapshotRecord* records = nullptr;
+    const char* names = nullptr;
+
+    bool validate(const fs::path& rootPath) {
+        if (mapped.size() < sizeof(SnapshotHeader)) return false;
+        header = reinterpret_cast<const SnapshotHeader*>(mapped.data());
+        if (!std::equal(magic, magic + sizeof(magic), header->magic) ||
+            header->version != version || header->byteOrderMark != byteOrderMark ||
+            header->recordSize != sizeof(SnapshotRecord) || header->nodeCount == 0 ||
+            header->nodeCount >= npos) {
+            return false;
+        }
+
+        uint64_t recordsBytes = header->nodeCount * sizeof(SnapshotRecord);
+        if (header->recordsOffset % alignof(SnapshotRecord) != 0 ||
+            header->recordsOffset + recordsBytes > mapped.size() ||
+            header->namesOffset < header->recordsOffset + recordsBytes ||
+            header->namesOffset + header->namesSize > mapped.size() ||
+            header->rootPathLength > header->namesSize) {
+            return false;
+        }
+        records = reinterpret_cast<const SnapshotRecord*>(mapped.data() + header->recordsOffset);
+        names = mapped.data() + header->namesOffset;
+
+        std::string storedRoot(names, header->rootPathLength);
+        if (storedRoot != rootPath.string()) return false;
+
+        // Bounds-check every record once so browsing can trust the offsets.
+        // Ranges must nest: the walks that keep a stack of open ancestors
+        // rely on a child's range ending inside its parent's.
+        if (records[0].subtreeEnd != size()) return false;
+        std::vector<uint32_t> openEnds;
+        for (uint32_t i = 0; i < size(); ++i) {
+            const SnapshotRecord& rec = records[i];
+            while (!openEnds.empty() && openEnds.back() <= i) openEnds.pop_back();
+            if (static_cast<uint64_t>(rec.nameOffset) + rec.nameLength > header->namesSize ||
+                rec.subtreeEnd <= i || rec.subtreeEnd > size() ||
+                (!openEnds.empty() && rec.subtreeEnd > openEnds.back()) ||
+                (rec.type != Node::DIRECTORY && rec.subtreeEnd != i + 1)) {
+                return false;
+            }
+            if (rec.type == Node::DIRECTORY) openEnds.push_back(rec.subtreeEnd);
+        }
+        return true;
+    }
+};
+
+// Writes snapshots in the MappedSnapshot layout
+class TreeSnapshot {
+public:
+    // Per-user cache file for a given root directory
+    static fs::path defaultPath(const fs::path& rootPath) {
+        fs::path dir;
+#ifdef _WIN32
+        if (const char* local = std::getenv("LOCALAPPDATA")) dir = local;
+#else
+        if (const char* cache = std::getenv("XDG_CACHE_HOME")) {
+            dir = cache;
+        } else if (const char* home = std::getenv("HOME")) {
+            dir = fs::path(home) / ".cache";
+        }
+#endif
+        if (dir.empty()) {
+            std::error_code ec;
+            dir = fs::temp_directory_path(ec);
+        }
+
+        std::ostringstream name;
+        name << std::hex << std::hash<std::string>{}(rootPath.string()) << ".snap";
+        return dir / "file-system-manager" / name.str();
+    }
+
+    // Subtrees of directories that are still lazy are copied from `view`
+    static bool save(const Node* root, const MappedSnapshot* view, const fs::path& snapshotFile) {
+        if (!root) return false;
+
+        std::vector<SnapshotRecord> records;
+        std::string names = root->pathString();
+        size_t rootPathLength = names.size();
+        try {
+            appendNode(records, names, root, view);
+        } catch (const std::exception& e) {
+            std::cerr << "Error writing snapshot: " << e.what() << "\n";
+            return false;
+        }
+
+        SnapshotHeader header{};
+        std::copy(MappedSnapshot::magic, MappedSnapshot::magic + sizeof(header.magic), header.magic);
+        header.version = MappedSnapshot::version;
+        header.byteOrderMark = MappedSnapshot::byteOrderMark;
+        header.recordSize = sizeof(SnapshotRecord);
+        header.nodeCount = records.size();
+        header.recordsOffset = sizeof(SnapshotHeader);
+        header.namesOffset = header.recordsOffset + records.size() * sizeof(SnapshotRecord);
+        header.namesSize = names.size();
+        header.rootPathLength = static_cast<uint32_t>(rootPathLength);
+
+        // Write to a temporary file and rename so a crash never leaves a
+        // truncated snapshot behind. Readers that still map the old file
+        // keep seeing it until they unmap. The temporary name is unique, so
+        // processes saving the same snapshot at once never share a file.
+        std::error_code ec;
+        fs::create_directories(snapshotFile.parent_path(), ec);
+        fs::path tempFile;
+        if (!createTempFile(snapshotFile, tempFile)) {
+            std::cerr << "Error writing snapshot: cannot create a file next to " << snapshotFile << "\n";
+            return false;
+        }
+        {
+            std::ofstream ofs(tempFile, std::ios::binary | std::ios::trunc);
+            ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            ofs.write(reinterpret_cast<const char*>(records.data()),
+                      static_cast<std::streamsize>(records.size() * sizeof(SnapshotRecord)));
+            ofs.write(names.data(), static_cast<std::streamsize>(names.size()));
+            if (!ofs) {
+                std::cerr << "Error writing snapshot: " << tempFile << "\n";
+                fs::remove(tempFile, ec);
+                return false;
+            }
+        }
+        fs::rename(tempFile, snapshotFile, ec);
+        if (ec) {
+            std::cerr << "Error saving snapshot " << snapshotFile << ": " << ec.message() << "\n";
+            fs::remove(tempFile, ec);
+            return false;
+        }
+        return true;
+    }
+
+private:
+    // Creates an empty file with a unique name next to target
+    static bool createTempFile(const fs::path& target, fs::path& tempFile) {
+#ifdef _WIN32
+        static std::atomic<unsigned> counter{0};
+        for (int attempt = 0; attempt < 100; ++attempt) {
+            tempFile = target;
+            tempFile += "." + std::to_string(GetCurrentProcessId()) + "." +
+                        std::to_string(counter++) + ".tmp";
+            HANDLE handle = CreateFileW(tempFile.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_NEW,
+                                        FILE_ATTRIBUTE_NORMAL, nullptr);
+            if (handle != INVALID_HANDLE_VALUE) {
+                CloseHandle(handle);
+                return true;
+            }
+            if (GetLastError() != ERROR_FILE_EXISTS) return false;
+        }
+        return false;
+#else
+        std::string pattern = target.string() + ".XXXXXX";
+        int fd = ::mkstemp(pattern.data());
+        if (fd < 0) return false;
+        ::close(fd);
+        tempFile = pattern;
+        return true;
+#endif
+    }
+
+    static uint32_t appendRecord(std::vector<SnapshotRecord>& records, std::string& names,
+                                 std::string_view name, bool isDirectory,
+                                 uintmax_t size, FileTime lastModified, uint64_t inode) {
+        if (name.size() > UINT16_MAX || names.size() + name.size() > UINT32_MAX ||
+            records.size() >= MappedSnapshot::npos) {
+            throw std::length_error("tree too large for the snapshot format");
+        }
+        SnapshotRecord rec{};
+        rec.size = size;
+        rec.lastModified = lastModified;
+        rec.inode = inode;
+        rec.nameOffset = static_cast<uint32_t>(names.size());
+        rec.nameLength = static_cast<uint16_t>(name.size());
+        rec.type = isDirectory ? Node::DIRECTORY : Node::FILE;
+        names += name;
+        records.push_back(rec);
+        return static_cast<uint32_t>(records.size() - 1);
+    }
+
+    static void appendNode(std::vector<SnapshotRecord>& records, std::string& names,
+                           const Node* node, const MappedSnapshot* view) {
+        uint32_t index = appendRecord(records, names, node->name(), node->type == Node::DIRECTORY,
+                                      node->size(), node->lastModified, node->inode());
+        if (node->lazy && view) {
+            // Copy the untouched subtree, shifting indices to their new place
+            uint32_t source = node->snapshotIndex;
+            for (uint32_t i = source + 1; i < view->end(source); ++i) {
+                const SnapshotRecord& rec = view->record(i);
+                uint32_t copied = appendRecord(records, names, view->name(i),
+                                               rec.type == Node::DIRECTORY, rec.size,
+                                               rec.lastModified, rec.inode);
+                records[copied].subtreeEnd = rec.subtreeEnd - source + index;
+                records[copied].childCount = rec.childCount;
+            }
+            records[index].childCount = view->record(source).childCount;
+        } else {
+            for (const Node* child : node->children) {
+                appendNode(records, names, child, view);
+            }
+            records[index].childCount = static_cast<uint32_t>(node->children.size());
+        }
+        records[index].subtreeEnd = static_cast<uint32_t>(records.size());
+    }
+};
+
+// ==================== Columnar Tree View ====================
+// Structure-of-arrays copy of the loaded tree in pre-order, for the
+// operations that sweep the whole tree (display and search) but only
+// look at a field or two per node: reading these arrays front to back is a
+// sequential pass instead of a pointer chase per node. The descendants of
+// row r are rows [r + 1, subtreeEnd[r]). A lazy directory is a single row;
+// its contents stay in the snapshot.
+class TreeColumns {
+public:
+    enum Flags : uint8_t { DIRECTORY_ROW = 1, LAZY_ROW = 2 };
+
+    std::vector<Node*> node;
+    std::vector<NamePool::Id> nameId;
+    std::vector<uint32_t> subtreeEnd;
+    std::vector<uint16_t> depth;
+    std::vector<uint8_t> flags;
+    std::vector<uint64_t> size; // a directory's is that of everything below it
+    std::vector<FileTime> lastModified; // ... and its time the latest of its own and any below it
+
+    size_t rows() const { return node.size(); }
+
+    // The root's pool entry is its full path, so row 0 asks the Node
+    std::string_view name(size_t row) const {
+        return row == 0 ? node[0]->name() : NamePool::instance().get(nameId[row]);
+    }
+
+    void build(Node* root) {
+        size_t previousRows = rows();
+        clear();
+        if (!root) return;
+        reserve(previousRows);
+
+        std::vector<std::pair<Node*, uint16_t>> stack{{root, 0}};
+        std::vector<uint32_t> open; // rows whose subtree is still being appended
+        while (!stack.empty()) {
+            auto [current, level] = stack.back();
+            stack.pop_back();
+            while (!open.empty() && depth[open.back()] >= level) {
+                subtreeEnd[open.back()] = static_cast<uint32_t>(rows());
+                open.pop_back();
+            }
+
+            open.push_back(static_cast<uint32_t>(rows()));
+            node.push_back(current);
+            nameId.push_back(current->nameId);
+            subtreeEnd.push_back(0);
+            depth.push_back(level);
+            flags.push_back((current->type == Node::DIRECTORY ? DIRECTORY_ROW : 0) |
+                            (current->lazy ? LAZY_ROW : 0));
+            const SubtreeTotals& below = current->children.totals();
+            bool directory = current->type == Node::DIRECTORY;
+            size.push_back(directory ? below.bytes : current->size());
+            lastModified.push_back(directory ? std::max(current->lastModified, below.newest)
+                                             : current->lastModified);
+
+            if (current->lazy) continue;
+            for (size_t i = current->children.size(); i-- > 0;) {
+                stack.emplace_back(current->children[i], static_cast<uint16_t>(level + 1));
+            }
+        }
+        for (uint32_t row : open) subtreeEnd[row] = static_cast<uint32_t>(rows());
+    }
+
+private:
+    void clear() {
+        node.clear();
+        nameId.clear();
+        subtreeEnd.clear();
+        depth.clear();
+        flags.clear();
+        size.clear();
+        lastModified.clear();
+    }
+
+    void reserve(size_t count) {
+        node.reserve(count);
+        nameId.reserve(count);
+        subtreeEnd.reserve(count);
+        depth.reserve(count);
+        flags.reserve(count);
+        size.reserve(count);
+        lastModified.reserve(count);
+    }
+};
+
+// ==================== Name Index ====================
+// Every loaded Node other than the root, by name id and by (parent, name
+// id), so that findNode and path lookups do not have to walk the tree or
+// scan child lists. Lazy directories are kept in a set of their own: the
+// names below them are only in the snapshot and get searched there. Moving
+// a subtree only touches the entry of its top node.
+class NameIndex {
+public:
+    void clear() {
+        byName.clear();
+        byParent.clear();
+        lazyDirectories.clear();
+    }
+
+    void add(Node* node) {
+        if (node->parent) {
+            std::vector<Node*>& nodes = byName[node->nameId];
+            if (nodes.empty() && trackingNewNames) newNames.push_back(node->nameId);
+            nodes.push_back(node);
+            byParent[ChildKey{node->parent, node->nameId}] = node;
+        }
+        if (node->lazy) lazyDirectories.insert(node);
+    }
+
+    void remove(Node* node) {
+        lazyDirectories.erase(node);
+        auto child = byParent.find(ChildKey{node->parent, node->nameId});
+        if (child != byParent.end() && child->second == node) byParent.erase(child);
+
+        auto it = byName.find(node->nameId);
+        if (it == byName.end()) return;
+        auto& nodes = it->second;
+        nodes.erase(std::remove(nodes.begin(), nodes.end(), node), nodes.end());
+        if (nodes.empty()) byName.erase(it);
+    }
+
+    void addSubtree(Node* subtree) { forEach(subtree, [this](Node* node) { add(node); }); }
+    void removeSubtree(Node* subtree) { forEach(subtree, [this](Node* node) { remove(node); }); }
+
+    // Called once a lazy directory's children were materialized
+    void markLoaded(Node* dir) { lazyDirectories.erase(dir); }
+
+    // Loaded nodes with this name, oldest first
+    const std::vector<Node*>& find(NamePool::Id id) const {
+        static const std::vector<Node*> none;
+        auto it = byName.find(id);
+        return it == byName.end() ? none : it->second;
+    }
+
+    // The loaded child of parent with this name, or nullptr
+    Node* child(const Node* parent, NamePool::Id id) const {
+        auto it = byParent.find(ChildKey{parent, id});
+        return it == byParent.end() ? nullptr : it->second;
+    }
+
+    const std::unordered_set<Node*>& lazy() const { return lazyDirectories; }
+
+    template <typename Visit>
+    void forEachName(Visit visit) const {
+        for (const auto& [id, nodes] : byName) visit(id);
+    }
+
+    // From now on, remember the names that get their first node
+    void trackNewNames() { trackingNewNames = true; }
+    // Those names since the last call
+    std::vector<NamePool::Id> takeNewNames() { return std::exchange(newNames, {}); }
+
+private:
+    struct ChildKey {
+        const Node* parent;
+        NamePool::Id name;
+        bool operator==(const ChildKey& other) const {
+            return parent == other.parent && name == other.name;
+        }
+    };
+    struct ChildKeyHash {
+        size_t operator()(const ChildKey& key) const {
+            return std::hash<const Node*>()(key.parent) ^
+                   (static_cast<size_t>(key.name) * 0x9E3779B97F4A7C15ull);
+        }
+    };
+
+    std::unordered_map<NamePool::Id, std::vector<Node*>> byName;
+    std::unordered_map<ChildKey, Node*, ChildKeyHash> byParent;
+    std::unordered_set<Node*> lazyDirectories;
+    bool trackingNewNames = false;
+    std::vector<NamePool::Id> newNames;
+
+    template <typename Visit>
+    static void forEach(Node* subtree, Visit visit) {
+        std::vector<Node*> stack{subtree};
+        while (!stack.empty()) {
+            Node* node = stack.back();
+            stack.pop_back();
+            visit(node);
+            stack.insert(stack.end(), node->children.begin(), node->children.end());
+        }
+    }
+};
+
+// ==================== Search Pattern ====================
+// A search pattern, compiled once per search and matched case-insensitively
+// (ASCII) against names. Three engines:
+//  - LITERAL: substring search, used when the pattern has no metacharacter
+//    other than '.' (which is taken literally: it is in most file names)
+//  - GLOB: shell glob matched against the whole name, or against the path
+//    relative to the root if it contains '/'. '*' and '?' stop at '/', '**'
+//    does not, and '[...]' classes are supported. Used for patterns with a
+//    '/' and for those that contain '*' or '?' but are not valid regexes,
+//    such as *.log
+//  - REGEX: std::regex, for everything else
+// A "text:", "glob:" or "regex:" prefix forces an engine. The same name
+// turns up in many directories, so results for interned names are
+// remembered by name id.
+class SearchPattern {
+public:
+    enum Mode { AUTO, LITERAL, GLOB, REGEX };
+
+    // Throws std::regex_error if the pattern ends up as an invalid regex
+    explicit SearchPattern(const std::string& pattern, Mode requested = AUTO) {
+        std::string_view text = pattern;
+        if (requested == AUTO) {
+            for (auto [prefix, forced] : {std::pair{"text:", LITERAL}, {"glob:", GLOB}, {"regex:", REGEX}}) {
+                if (text.substr(0, std::strlen(prefix)) == prefix) {
+                    text.remove_prefix(std::strlen(prefix));
+                    requested = forced;
+                    break;
+                }
+            }
+        }
+        engine = requested == AUTO ? choose(text) : requested;
+
+        switch (engine) {
+        case LITERAL: compileLiteral(text); break;
+        case GLOB: compileGlob(text); break;
+        default:
+            source = text;
+            re = std::regex(text.begin(), text.end(),
+                            std::regex_constants::icase | std::regex_constants::optimize);
+        }
+    }
+
+    Mode mode() const { return engine; }
+
+    // LITERAL: the text to find, case-folded
+    const std::string& literal() const { return needle; }
+
+    // True if matches() wants paths relative to the root ("a/b/c.txt")
+    // rather than bare names
+    bool matchesPaths() const { return pathGlob; }
+
+    bool matches(std::string_view text) const {
+        switch (engine) {
+        case LITERAL: return containsLiteral(text);
+        case GLOB: return matchGlob(text);
+        default: return std::regex_search(text.begin(), text.end(), re);
+        }
+    }
+
+    bool matches(NamePool::Id id) {
+        auto [it, inserted] = seen.try_emplace(id, false);
+        if (inserted) it->second = matches(NamePool::instance().get(id));
+        return it->second;
+    }
+
+    // Folded strings that every matching name contains (see TrigramIndex).
+    // Empty when nothing is certain, e.g. for path globs or alternations.
+    std::vector<std::string> requiredLiterals() const {
+        std::vector<std::string> literals;
+        if (engine == LITERAL) {
+            literals.push_back(needle);
+        } else if (engine == GLOB && !pathGlob) {
+            std::string run;
+            for (const Token& token : tokens) {
+                if (token.kind == CHAR) {
+                    run.push_back(static_cast<char>(token.ch));
+                } else if (!run.empty()) {
+                    literals.push_back(std::move(run));
+                    run.clear();
+                }
+            }
+            if (!run.empty()) literals.push_back(std::move(run));
+        } else if (engine == REGEX) {
+            literals = regexLiterals(source);
+        }
+        return literals;
+    }
+
+private:
+    enum TokenKind : uint8_t { CHAR, ANY, CLASS, STAR, GLOBSTAR, GLOBSTAR_SLASH };
+    struct Token {
+        TokenKind kind;
+        unsigned char ch;   // CHAR, folded
+        uint16_t classIndex; // CLASS
+    };
+
+    Mode engine = REGEX;
+    std::string source; // REGEX
+    std::regex re;
+    std::unordered_map<NamePool::Id, bool> seen;
+
+    std::string needle; // LITERAL, folded
+    bool needleHasLetters = false;
+    std::array<uint32_t, 256> skip{}; // Horspool shifts, indexed by folded byte
+
+    std::vector<Token> tokens; // GLOB
+    std::vector<std::bitset<256>> classes;
+    bool pathGlob = false;
+    mutable std::vector<uint8_t> reach, nextReach; // scratch for matchGlob
+
+    static unsigned char fold(char c) {
+        return (c >= 'A' && c <= 'Z') ? static_cast<unsigned char>(c + ('a' - 'A'))
+                                      : static_cast<unsigned char>(c);
+    }
+
+    static Mode choose(std::string_view pattern) {
+        if (pattern.find('/') != std::string_view::npos) return GLOB; // Names never contain '/'
+        if (pattern.find_first_of("^$|()[]{}*+?\\") == std::string_view::npos) return LITERAL;
+        if (pattern.find_first_of("*?") != std::string_view::npos) {
+            try {
+                std::regex probe(pattern.begin(), pattern.end());
+            } catch (const std::regex_error&) {
+                return GLOB;
+            }
+        }
+        return REGEX;
+    }
+
+    // The literal runs of a regex outside groups and classes. A character
+    // that may be repeated zero times is left out and ends the run; one
+    // that may repeat ends it after being added. Alternations give nothing.
+    static std::vector<std::string> regexLiterals(std::string_view re) {
+        std::vector<std::string> literals;
+        if (re.find('|') != std::string_view::npos) return literals;
+
+        std::string run;
+        auto flush = [&] {
+            if (!run.empty()) literals.push_back(std::move(run));
+            run.clear();
+        };
+        for (size_t i = 0; i < re.size(); ++i) {
+            char c = re[i];
+            if (c == '(' || c == '[') {
+                flush();
+                if (!skipBracketed(re, i)) return {};
+                continue;
+            }
+            if (c == '{') {
+                flush();
+                size_t close = re.find('}', i);
+                if (close == std::string_view::npos) return {};
+                i = close;
+                continue;
+            }
+            if (std::strchr(".^$*+?", c)) {
+                flush();
+                continue;
+            }
+            if (c == '\\') {
+                if (++i == re.size()) return {};
+                c = re[i];
+                if (std::isalnum(static_cast<unsigned char>(c))) { // \d, \w, \b, \1...
+                    flush();
+                    // Skip the operand of \xHH, \uHHHH, \cX and the rest of
+                    // a backreference, none of which is matched literally
+                    size_t operand = c == 'x' ? 2 : c == 'u' ? 4 : c == 'c' ? 1 : 0;
+                    if (std::isdigit(static_cast<unsigned char>(c))) {
+                        while (operand + i + 1 < re.size() &&
+                               std::isdigit(static_cast<unsigned char>(re[operand + i + 1]))) {
+                            ++operand;
+                        }
+                    }
+                    i = std::min(i + operand, re.size() - 1);
+                    continue;
+                }
+            }
+
+            char next = i + 1 < re.size() ? re[i + 1] : '\0';
+            if (next == '*' || next == '?' || next == '{') {
+                flush();
+                continue;
+            }
+            run.push_back(static_cast<char>(fold(c)));
+            if (next == '+') flush();
+        }
+        flush();
+        return literals;
+    }
+
+    // Moves i from the '(' or '[' it is on to the matching ')' or ']'
+    static bool skipBracketed(std::string_view re, size_t& i) {
+        int depth = 0;
+        bool inClass = false;
+        for (; i < re.size(); ++i) {
+            char c = re[i];
+            if (c == '\\') {
+                ++i;
+            } else if (inClass) {
+                if (c == ']') {
+                    inClass = false;
+                    if (depth == 0) return true;
+                }
+            } else if (c == '[') {
+                inClass = true;
+                if (i + 1 < re.size() && re[i + 1] == ']') ++i; // "[]...]"
+                else if (i + 2 < re.size() && re[i + 1] == '^' && re[i + 2] == ']') i += 2;
+            } else if (c == '(') {
+                ++depth;
+            } else if (c == ')' && --depth == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void compileLiteral(std::string_view text) {
+        for (char c : text) {
+            unsigned char folded = fold(c);
+            needle.push_back(static_cast<char>(folded));
+            needleHasLetters |= folded >= 'a' && folded <= 'z';
+        }
+        size_t m = needle.size();
+        skip.fill(static_cast<uint32_t>(m ? m : 1));
+        for (size_t i = 0; i + 1 < m; ++i) {
+            skip[static_cast<unsigned char>(needle[i])] = static_cast<uint32_t>(m - 1 - i);
+        }
+    }
+
+    // Without letters there is nothing to fold and the library search
+    // (memchr/memcmp underneath) is fastest; otherwise Horspool on folded bytes
+    bool containsLiteral(std::string_view text) const {
+        if (!needleHasLetters) return text.find(needle) != std::string_view::npos;
+        size_t m = needle.size();
+        if (m == 0) return true;
+        const unsigned char last = static_cast<unsigned char>(needle[m - 1]);
+        for (size_t i = 0; i + m <= text.size();) {
+            unsigned char c = fold(text[i + m - 1]);
+            if (c == last) {
+                size_t j = 0;
+                while (j + 1 < m && fold(text[i + j]) == static_cast<unsigned char>(needle[j])) ++j;
+                if (j + 1 >= m) return true;
+            }
+            i += skip[c];
+        }
+        return false;
+    }
+
+    void compileGlob(std::string_view glob) {
+        for (size_t i = 0; i < glob.size(); ++i) {
+            char c = glob[i];
+            if (c == '*') {
+                if (i + 1 < glob.size() && glob[i + 1] == '*') {
+                    ++i;
+                    if (i + 1 < glob.size() && glob[i + 1] == '/') {
+                        ++i;
+                        tokens.push_back({GLOBSTAR_SLASH, 0, 0});
+                    } else {
+                        tokens.push_back({GLOBSTAR, 0, 0});
+                    }
+                } else {
+                    tokens.push_back({STAR, 0, 0});
+                }
+            } else if (c == '?') {
+                tokens.push_back({ANY, 0, 0});
+            } else if (c == '[' && compileClass(glob, i)) {
+                tokens.push_back({CLASS, 0, static_cast<uint16_t>(classes.size() - 1)});
+            } else {
+                if (c == '\\' && i + 1 < glob.size()) c = glob[++i];
+                if (c == '/') pathGlob = true;
+                tokens.push_back({CHAR, fold(c), 0});
+            }
+        }
+        if (!tokens.empty() && (tokens.front().kind == GLOBSTAR || tokens.front().kind == GLOBSTAR_SLASH)) {
+            pathGlob = true;
+        }
+    }
+
+    // Parses the class opening at glob[i]; on success leaves i on its ']'.
+    // An unterminated '[' is an ordinary character.
+    bool compileClass(std::string_view glob, size_t& i) {
+        size_t j = i + 1;
+        bool negate = j < glob.size() && (glob[j] == '!' || glob[j] == '^');
+        if (negate) ++j;
+        std::bitset<256> members;
+        for (bool first = true; j < glob.size() && (first || glob[j] != ']'); first = false) {
+            unsigned char low = fold(glob[j]);
+            unsigned char high = low;
+            if (j + 2 < glob.size() && glob[j + 1] == '-' && glob[j + 2] != ']') {
+                high = fold(glob[j + 2]);
+                j += 3;
+            } else {
+                ++j;
+            }
+            for (unsigned c = low; c <= high; ++c) members.set(c);
+        }
+        if (j >= glob.size()) return false;
+        if (negate) {
+            members.flip();
+            members.reset('/');
+        }
+        classes.push_back(members);
+        i = j;
+        return true;
+    }
+
+    // Whole-text match, one pass per token over the set of reachable
+    // positions: O(tokens * length) whatever the stars
+    bool matchGlob(std::string_view text) const {
+        size_t n = text.size();
+        reach.assign(n + 1, 0);
+        reach[0] = 1;
+        for (const Token& token : tokens) {
+            nextReach.assign(n + 1, 0);
+            bool any = false;
+            switch (token.kind) {
+            case CHAR:
+            case ANY:
+            case CLASS:
+                for (size_t i = 0; i < n; ++i) {
+                    if (!reach[i]) continue;
+                    unsigned char c = fold(text[i]);
+                    bool ok = token.kind == CHAR ? c == token.ch :
+                              token.kind == ANY ? c != '/' : classes[token.classIndex].test(c);
+                    if (ok) {
+                        nextReach[i + 1] = 1;
+                        any = true;
+                    }
+                }
+                break;
+            case STAR:
+            case GLOBSTAR:
+                for (size_t i = 0; i <= n; ++i) {
+                    nextReach[i] = reach[i] || (i > 0 && nextReach[i - 1] &&
+                                                (token.kind == GLOBSTAR || text[i - 1] != '/'));
+                    any |= nextReach[i];
+                }
+                break;
+            case GLOBSTAR_SLASH: { // zero or more whole directories
+                bool seenStart = false;
+                for (size_t i = 0; i <= n; ++i) {
+                    nextReach[i] = reach[i] || (seenStart && text[i - 1] == '/');
+                    seenStart |= reach[i] != 0;
+                    any |= nextReach[i];
+                }
+                break;
+            }
+            }
+            if (!any) return false;
+            reach.swap(nextReach);
+        }
+        return reach[n] != 0;
+    }
+};
+
+// ==================== Trigram Index ====================
+// Optional inverted index from trigrams (three folded bytes) to the names
+// containing them, as code search engines do it: a search intersects the
+// posting lists of the trigrams its pattern requires and only verifies
+// the names that are in all of them. Loaded names are indexed once per
+// distinct name id, as they first appear in the tree; the records of a
+// mapped snapshot are indexed in one pass when first needed. Names that
+// have left the tree stay indexed and simply match no node.
+class TrigramIndex {
+public:
+    // The trigrams of the given (folded) literals; empty if they are all
+    // shorter than three bytes, in which case the index cannot help
+    static std::vector<uint32_t> trigramsOf(const std::vector<std::string>& literals) {
+        std::vector<uint32_t> trigrams;
+        for (const std::string& literal : literals) {
+            appendTrigrams(literal, false, trigrams);
+        }
+        std::sort(trigrams.begin(), trigrams.end());
+        trigrams.erase(std::unique(trigrams.begin(), trigrams.end()), trigrams.end());
+        return trigrams;
+    }
+
+    void addName(NamePool::Id id) {
+        if (!indexedNames.insert(id).second) return;
+        scratch.clear();
+        appendTrigrams(NamePool::instance().get(id), true, scratch);
+        std::sort(scratch.begin(), scratch.end());
+        scratch.erase(std::unique(scratch.begin(), scratch.end()), scratch.end());
+        for (uint32_t trigram : scratch) {
+            Posting& posting = namePostings[trigram];
+            if (!posting.entries.empty() && posting.entries.back() > id) posting.sorted = false;
+            posting.entries.push_back(id);
+        }
+    }
+
+    // Ids of the indexed names that contain every trigram, in id order
+    std::vector<NamePool::Id> candidateNames(const std::vector<uint32_t>& trigrams) {
+        std::vector<std::vector<uint32_t>*> lists;
+        for (uint32_t trigram : trigrams) {
+            auto it = namePostings.find(trigram);
+            if (it == namePostings.end()) return {};
+            Posting& posting = it->second;
+            if (!posting.sorted) {
+                std::sort(posting.entries.begin(), posting.entries.end());
+                posting.sorted = true;
+            }
+            lists.push_back(&posting.entries);
+        }
+        return intersect(lists);
+    }
+
+    // Records of snapshot whose names contain every trigram, in order
+    std::vector<uint32_t> candidateRecords(const MappedSnapshot& snapshot,
+                                           const std::vector<uint32_t>& trigrams) {
+        if (!snapshotIndexed) {
+            for (uint32_t i = 0; i < snapshot.size(); ++i) {
+                scratch.clear();
+                appendTrigrams(snapshot.name(i), true, scratch);
+                std::sort(scratch.begin(), scratch.end());
+                scratch.erase(std::unique(scratch.begin(), scratch.end()), scratch.end());
+                for (uint32_t trigram : scratch) recordPostings[trigram].push_back(i);
+            }
+            snapshotIndexed = true;
+        }
+
+        std::vector<std::vector<uint32_t>*> lists;
+        for (uint32_t trigram : trigrams) {
+            auto it = recordPostings.find(trigram);
+            if (it == recordPostings.end()) return {};
+            lists.push_back(&it->second);
+        }
+        return intersect(lists);
+    }
+
+    // To be called whenever the mapped snapshot is replaced or dropped
+    void forgetSnapshot() {
+        recordPostings.clear();
+        snapshotIndexed = false;
+    }
+
+private:
+    struct Posting {
+        std::vector<uint32_t> entries;
+        bool sorted = true;
+    };
+
+    std::unordered_map<uint32_t, Posting> namePostings;
+    std::unordered_set<NamePool::Id> indexedNames;
+    std::unordered_map<uint32_t, std::vector<uint32_t>> recordPostings;
+    bool snapshotIndexed = false;
+    std::vector<uint32_t> scratch;
+
+    static void appendTrigrams(std::string_view text, bool foldText, std::vector<uint32_t>& out) {
+        for (size_t i = 0; i + 3 <= text.size(); ++i) {
+            uint32_t trigram = 0;
+            for (size_t j = i; j < i + 3; ++j) {
+                unsigned char c = static_cast<unsigned char>(text[j]);
+                if (foldText && c >= 'A' && c <= 'Z') c = static_cast<unsigned char>(c + ('a' - 'A'));
+                trigram = (trigram << 8) | c;
+            }
+            out.push_back(trigram);
+        }
+    }
+
+    // Sorted lists in, their intersection out; shortest list first
+    static std::vector<uint32_t> intersect(std::vector<std::vector<uint32_t>*>& lists) {
+        if (lists.empty()) return {};
+        std::sort(lists.begin(), lists.end(),
+                  [](const auto* a, const auto* b) { return a->size() < b->size(); });
+        std::vector<uint32_t> result = *lists.front();
+        std::vector<uint32_t> narrowed;
+        for (size_t i = 1; i < lists.size() && !result.empty(); ++i) {
+            narrowed.clear();
+            std::set_intersection(result.begin(), result.end(), lists[i]->begin(), lists[i]->end(),
+                                  std::back_inserter(narrowed));
+            result.swap(narrowed);
+        }
+        return result;
+    }
+};
+
+// ==================== Parallel Search ====================
+// Matches a SearchPattern against a TreeColumns view, and against the
+// snapshot records below its lazy rows, on several threads. The rows are cut
+// into chunks up front; big lazy subtrees are cut into record chunks by the
+// worker that meets them. Hits reach the calling thread as soon as a chunk
+// is done (see next()), and it may change the tree meanwhile as long as it
+// leaves the view, the mapping and existing names alone.
+class ParallelSearch {
+public:
+    struct Hit {
+        uint32_t row;
+        uint32_t record; // MappedSnapshot::npos for the loaded node of the row
+    };
+
+    ParallelSearch(const TreeColumns& view, const MappedSnapshot* snapshot,
+                   const SearchPattern& pattern, unsigned workers = 0)
+        : view(view), snapshot(snapshot) {
+        size_t rows = view.rows();
+        for (size_t begin = 0; begin < rows; begin += chunkSize) {
+            Chunk chunk;
+            chunk.begin = static_cast<uint32_t>(begin);
+            chunk.end = static_cast<uint32_t>(std::min(rows, begin + chunkSize));
+            chunks.push_back(std::move(chunk));
+        }
+        pending = chunks.size();
+
+        unsigned count = workers ? workers : ParallelScanner::defaultWorkers();
+        count = static_cast<unsigned>(std::max<size_t>(1, std::min<size_t>(count, chunks.size())));
+        for (unsigned i = 0; i < count; ++i) {
+            threads.emplace_back(&ParallelSearch::workerLoop, this, pattern);
+        }
+    }
+
+    ParallelSearch(const ParallelSearch&) = delete;
+    ParallelSearch& operator=(const ParallelSearch&) = delete;
+
+    ~ParallelSearch() {
+        cancel();
+        for (auto& t : threads) {
+            t.join();
+        }
+    }
+
+    // Workers stop at their next row or record
+    void cancel() {
+        std::lock_guard<std::mutex> lock(mutex);
+        cancelled = true;
+        wake.notify_all();
+    }
+
+    // Waits for hits found since the last call and swaps them into hits.
+    // Returns false once the search is over and everything was handed out;
+    // rethrows a std::regex_error a worker ran into.
+    bool next(std::vector<Hit>& hits) {
+        hits.clear();
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [this] { return !found.empty() || pending == 0 || stopped(); });
+        if (error) std::rethrow_exception(error);
+        hits.swap(found);
+        return !hits.empty();
+    }
+
+    static std::string joinRelative(std::string_view dir, std::string_view name) {
+        std::string path;
+        path.reserve(dir.size() + 1 + name.size());
+        if (!dir.empty()) path.append(dir).push_back('/');
+        path.append(name);
+        return path;
+    }
+
+private:
+    static constexpr size_t chunkSize = 16384; // rows or records per chunk
+
+    // Rows [begin, end) of the view, or, if lazyRow is set, snapshot
+    // records [begin, end) below that row's record
+    struct Chunk {
+        uint32_t begin = 0, end = 0;
+        uint32_t lazyRow = UINT32_MAX;
+        std::string rowPath; // relative path of lazyRow, for path globs
+    };
+
+    const TreeColumns& view;
+    const MappedSnapshot* snapshot;
+    std::vector<std::thread> threads;
+
+    std::mutex mutex; // guards everything below
+    std::condition_variable wake;
+    std::deque<Chunk> chunks;
+    size_t pending = 0; // chunks queued or being searched
+    std::vector<Hit> found;
+    std::exception_ptr error;
+    std::atomic<bool> cancelled{false}; // set under the mutex, read without it
+
+    void workerLoop(SearchPattern matcher) { // Each worker has its own copy
+        std::vector<Hit> hits;
+        while (true) {
+            Chunk chunk;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return !chunks.empty() || pending == 0 || stopped(); });
+                if (stopped() || chunks.empty()) return;
+                chunk = std::move(chunks.front());
+                chunks.pop_front();
+            }
+
+            try {
+                if (chunk.lazyRow == UINT32_MAX) {
+                    searchRows(chunk.begin, chunk.end, matcher, hits);
+                } else {
+                    searchRecords(chunk, matcher, hits);
+                }
+            } catch (const std::regex_error&) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!error) error = std::current_exception();
+                cancelled = true;
+                wake.notify_all();
+                return;
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            found.insert(found.end(), hits.begin(), hits.end());
+            hits.clear();
+            --pending;
+            wake.notify_all();
+        }
+    }
+
+    void searchRows(uint32_t begin, uint32_t end, SearchPattern& matcher, std::vector<Hit>& hits) {
+        bool byPath = matcher.matchesPaths();
+        std::vector<std::string> paths; // path globs: relative path at each depth
+        if (byPath) seedPaths(begin, paths);
+
+        for (uint32_t row = begin; row < end && !stopped(); ++row) {
+            bool hit;
+            if (byPath) {
+                size_t depth = view.depth[row];
+                paths.resize(depth + 1);
+                if (depth > 0) paths[depth] = joinRelative(paths[depth - 1], view.name(row));
+                hit = depth > 0 && matcher.matches(paths[depth]); // The root has no relative path
+            } else {
+                hit = row == 0 ? matcher.matches(view.name(0)) : matcher.matches(view.nameId[row]);
+            }
+            if (hit) hits.push_back({row, MappedSnapshot::npos});
+            if (!(view.flags[row] & TreeColumns::LAZY_ROW) || !snapshot) continue;
+
+            Chunk lazy;
+            lazy.lazyRow = row;
+            if (byPath) lazy.rowPath = paths.back();
+            uint32_t index = view.node[row]->snapshotIndex;
+            uint32_t last = snapshot->end(index);
+            if (last - index - 1 <= chunkSize) {
+                lazy.begin = index + 1;
+                lazy.end = last;
+                searchRecords(lazy, matcher, hits);
+                continue;
+            }
+
+            // Too big to search here: hand it out in pieces
+            std::lock_guard<std::mutex> lock(mutex);
+            for (uint32_t first = index + 1; first < last; first += chunkSize) {
+                lazy.begin = first;
+                lazy.end = static_cast<uint32_t>(std::min<size_t>(last, size_t(first) + chunkSize));
+                chunks.push_back(lazy);
+                ++pending;
+            }
+            wake.notify_all();
+        }
+    }
+
+    void searchRecords(const Chunk& chunk, SearchPattern& matcher, std::vector<Hit>& hits) {
+        if (!matcher.matchesPaths()) {
+            for (uint32_t i = chunk.begin; i < chunk.end && !stopped(); ++i) {
+                if (matcher.matches(snapshot->name(i))) hits.push_back({chunk.lazyRow, i});
+            }
+            return;
+        }
+
+        // Paths of the records enclosing chunk.begin, found by skipping
+        // whole sibling subtrees on the way down from the lazy row's record
+        uint32_t top = view.node[chunk.lazyRow]->snapshotIndex;
+        std::vector<std::pair<uint32_t, std::string>> ancestors{{top, chunk.rowPath}};
+        for (uint32_t i = top + 1; i < chunk.begin;) {
+            if (snapshot->end(i) <= chunk.begin) {
+                i = snapshot->end(i);
+                continue;
+            }
+            ancestors.emplace_back(i, joinRelative(ancestors.back().second, snapshot->name(i)));
+            ++i;
+        }
+
+        for (uint32_t i = chunk.begin; i < chunk.end && !stopped(); ++i) {
+            while (i >= snapshot->end(ancestors.back().first)) ancestors.pop_back();
+            std::string path = joinRelative(ancestors.back().second, snapshot->name(i));
+            if (matcher.matches(path)) hits.push_back({chunk.lazyRow, i});
+            if (snapshot->isDirectory(i)) ancestors.emplace_back(i, std::move(path));
+        }
+    }
+
+    // Fills paths[0, depth) with the relative paths of row's ancestors; rows
+    // after it at a smaller depth have their parents among these
+    void seedPaths(uint32_t row, std::vector<std::string>& paths) const {
+        std::vector<const Node*> chain;
+        for (const Node* node = view.node[row]->parent; node && node->parent; node = node->parent) {
+            chain.push_back(node);
+        }
+        paths.assign(1, std::string());
+        for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+            paths.push_back(joinRelative(paths.back(), (*it)->name()));
+        }
+    }
+
+    bool stopped() const { return cancelled.load(std::memory_order_relaxed); }
+};
+
+// ==================== Content Search ====================
+// Looks for a string inside a list of files on several threads, like grep
+// -F: each file is mapped, skipped if it looks binary (a NUL byte in its
+// first 8 KiB) and scanned with memmem. Matching lines reach the calling
+// thread file by file (see next()).
+class ContentSearch {
+public:
+    struct Hit {
+        size_t file;     // index into the list of files
+        uint64_t line;   // 1-based
+        std::string text; // the line, cut at maxLineLength
+    };
+
+    static constexpr size_t maxLineLength = 200;
+
+    ContentSearch(std::vector<fs::path> files, std::string needle, unsigned workers = 0)
+        : files(std::move(files)), needle(std::move(needle)) {
+        unsigned count = workers ? workers : ParallelScanner::defaultWorkers();
+        count = static_cast<unsigned>(std::max<size_t>(1, std::min<size_t>(count, this->files.size())));
+        running = count;
+        for (unsigned i = 0; i < count; ++i) {
+            threads.emplace_back(&ContentSearch::workerLoop, this);
+        }
+    }
+
+    ContentSearch(const ContentSearch&) = delete;
+    ContentSearch& operator=(const ContentSearch&) = delete;
+
+    ~ContentSearch() {
+        cancel();
+        for (auto& t : threads) {
+            t.join();
+        }
+    }
+
+    const fs::path& file(size_t index) const { return files[index]; }
+
+    void cancel() {
+        std::lock_guard<std::mutex> lock(mutex);
+        cancelled = true;
+        wake.notify_all();
+    }
+
+    // Waits for hits found since the last call and swaps them into hits.
+    // Returns false once every file was searched and everything handed out.
+    bool next(std::vector<Hit>& hits) {
+        hits.clear();
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [this] { return !found.empty() || running == 0 || cancelled; });
+        hits.swap(found);
+        return !hits.empty();
+    }
+
+    size_t filesSearched() const { return searched.load(); }
+    size_t binaryFilesSkipped() const { return skipped.load(); }
+    uint64_t bytesSearched() const { return bytes.load(); }
+
+private:
+    static constexpr size_t binaryProbe = 8192;
+
+    const std::vector<fs::path> files;
+    const std::string needle;
+    std::vector<std::thread> threads;
+    std::atomic<size_t> nextFile{0};
+    std::atomic<size_t> searched{0}, skipped{0};
+    std::atomic<uint64_t> bytes{0};
+
+    std::mutex mutex; // guards everything below
+    std::condition_variable wake;
+    std::vector<Hit> found;
+    unsigned running = 0; // workers still searching
+    std::atomic<bool> cancelled{false}; // set under the mutex, read without it
+
+    void workerLoop() {
+        std::vector<Hit> hits;
+        for (size_t index; !cancelled.load(std::memory_order_relaxed) &&
+                           (index = nextFile.fetch_add(1)) < files.size();) {
+            searchFile(index, hits);
+            if (hits.empty()) continue;
+            std::lock_guard<std::mutex> lock(mutex);
+            std::move(hits.begin(), hits.end(), std::back_inserter(found));
+            hits.clear();
+            wake.notify_all();
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        --running;
+        wake.notify_all();
+    }
+
+    void searchFile(size_t index, std::vector<Hit>& hits) {
+        MappedFile file;
+        if (!file.map(files[index], true)) return; // Unreadable, empty or not a regular file
+        const char* data = file.data();
+        size_t size = file.size();
+        ++searched;
+        if (std::memchr(data, '\0', std::min(size, binaryProbe))) {
+            ++skipped;
+            return;
+        }
+        bytes += size;
+
+        uint64_t line = 1;
+        const char* lineStart = data; // of `line`
+        const char* end = data + size;
+        for (const char* from = data; from < end && !cancelled.load(std::memory_order_relaxed);) {
+            const char* match = find(from, end);
+            if (!match) break;
+
+            // Lines are only counted up to a match
+            while (const void* newline = std::memchr(lineStart, '\n', match - lineStart)) {
+                lineStart = static_cast<const char*>(newline) + 1;
+                ++line;
+            }
+            const char* lineEnd = static_cast<const char*>(std::memchr(match, '\n', end - match));
+            if (!lineEnd) lineEnd = end;
+
+            size_t length = std::min<size_t>(lineEnd - lineStart, maxLineLength);
+            if (length && lineStart[length - 1] == '\r') --length;
+            hits.push_back({index, line, std::string(lineStart, length)});
+            from = lineEnd; // One hit per line
+        }
+    }
+
+    const char* find(const char* from, const char* end) const {
+#ifdef _WIN32
+        std::string_view rest(from, end - from);
+        size_t at = rest.find(needle);
+        return at == std::string_view::npos ? nullptr : from + at;
+#else
+        return static_cast<const char*>(::memmem(from, end - from, needle.data(), needle.size()));
+#endif
+    }
+};
+
+// ==================== Tree Query ====================
+// A filter over the metadata already in the tree, e.g.
+//   ext:log size>100M mtime<30d type:file path:~/var/
+// Terms are separated by spaces and must all hold; a leading '!' negates
+// one. Terms:
+//   type:file|dir        ext:EXT (case-insensitive, may contain dots)
+//   size OP N[B|K|M|G|T] (powers of 1024; OP is <, <=, >, >=, =); for a
+//                        directory, the size of everything below it
+//   mtime OP N[s|m|h|d|w] compares the age: mtime<30d is "changed in the
+//                        last 30 days"; mtime OP YYYY-MM-DD compares dates;
+//                        a directory's is the latest of its own and any below
+//   name:PATTERN or a bare PATTERN: as in a name search (text, glob, regex);
+//                        a glob with a '/' sees the path relative to the root
+//   path:TEXT            the full path contains TEXT (a leading ~ is the
+//                        home directory)
+// Terms are evaluated cheapest first and stop at the first that fails, so
+// the costly name and path tests only see entries that passed the rest.
+// Throws std::invalid_argument (or std::regex_error) on a bad query.
+class TreeQuery {
+public:
+    // What a term can look at; the path is only built if a term needs it
+    struct Entry {
+        bool directory;
+        uint64_t size;
+        FileTime lastModified;
+        std::string_view name;
+        NamePool::Id nameId; // only if hasNameId
+        bool hasNameId;
+    };
+
+    explicit TreeQuery(const std::string& expression, time_t now = std::time(nullptr)) : now(now) {
+        std::istringstream words(expression);
+        std::string word;
+        while (words >> word) {
+            terms.push_back(parseTerm(word));
+            sourceWords.push_back(word);
+        }
+        if (terms.empty()) throw std::invalid_argument("empty query");
+        std::sort(sourceWords.begin(), sourceWords.end());
+        std::stable_sort(terms.begin(), terms.end(),
+                         [](const Term& a, const Term& b) { return a.kind < b.kind; });
+    }
+
+    bool needsPath() const {
+        return std::any_of(terms.begin(), terms.end(), [](const Term& t) {
+            return t.kind == PATH || (t.kind == NAME && t.pattern->matchesPaths());
+        });
+    }
+
+    // True if a term looks at a size or a time, which for a directory
+    // stand for everything below it
+    bool needsTotals() const {
+        return std::any_of(terms.begin(), terms.end(), [](const Term& t) { return t.kind == SIZE || t.kind == MTIME; });
+    }
+
+    // True if an mtime term is an age, so the answer changes as time passes
+    bool relativeToNow() const {
+        return std::any_of(terms.begin(), terms.end(),
+                           [](const Term& t) { return t.kind == MTIME && !t.absoluteTime; });
+    }
+
+    // True if every term of other is also a term of this query, so this one
+    // matches a subset of what other matches
+    bool narrows(const TreeQuery& other) const {
+        return std::includes(sourceWords.begin(), sourceWords.end(),
+                             other.sourceWords.begin(), other.sourceWords.end());
+    }
+
+    // path() (the full path) and relativePath() (relative to the root, with
+    // '/' separators, empty for the root) are only called when a term that
+    // needs them is reached
+    template <typename PathOf, typename RelativePathOf>
+    bool matches(const Entry& entry, PathOf&& path, RelativePathOf&& relativePath) {
+        for (Term& term : terms) {
+            if (test(term, entry, path, relativePath) == term.negate) return false;
+        }
+        return true;
+    }
+
+private:
+    // In order of cost: the cheapest are tested first
+    enum Kind { TYPE, SIZE, MTIME, EXT, NAME, PATH };
+    enum Op { LESS, LESS_EQUAL, GREATER, GREATER_EQUAL, EQUAL };
+
+    struct Term {
+        Kind kind;
+        bool negate = false;
+        Op op = EQUAL;
+        bool directory = false; // TYPE
+        int64_t number = 0;     // SIZE: bytes, MTIME: age in seconds or a time
+        bool absoluteTime = false;
+        std::string text;       // EXT: ".ext" folded, PATH: text to find
+        std::shared_ptr<SearchPattern> pattern; // NAME
+    };
+
+    time_t now;
+    std::vector<Term> terms;
+    std::vector<std::string> sourceWords; // sorted
+
+    template <typename PathOf, typename RelativePathOf>
+    bool test(Term& term, const Entry& entry, PathOf& path, RelativePathOf& relativePath) const {
+        switch (term.kind) {
+        case TYPE: return entry.directory == term.directory;
+        case SIZE: return compare(static_cast<int64_t>(entry.size), term.op, term.number);
+        case MTIME:
+            return term.absoluteTime ? compare(toSeconds(entry.lastModified), term.op, term.number)
+                                     : compare(now - toSeconds(entry.lastModified), term.op, term.number);
+        case EXT: {
+            if (entry.name.size() <= term.text.size()) return false;
+            std::string_view tail = entry.name.substr(entry.name.size() - term.text.size());
+            return std::equal(tail.begin(), tail.end(), term.text.begin(), [](char a, char b) {
+                return std::tolower(static_cast<unsigned char>(a)) == b;
+            });
+        }
+        case NAME:
+            if (term.pattern->matchesPaths()) { // As in a name search, the root has no relative path
+                std::string relative = relativePath();
+                return !relative.empty() && term.pattern->matches(relative);
+            }
+            return entry.hasNameId ? term.pattern->matches(entry.nameId) : term.pattern->matches(entry.name);
+        case PATH: return std::string_view(path()).find(term.text) != std::string_view::npos;
+        }
+        return false;
+    }
+
+    static bool compare(int64_t value, Op op, int64_t bound) {
+        switch (op) {
+        case LESS: return value < bound;
+        case LESS_EQUAL: return value <= bound;
+        case GREATER: return value > bound;
+        case GREATER_EQUAL: return value >= bound;
+        default: return value == bound;
+        }
+    }
+
+    Term parseTerm(std::string word) const {
+        Term term;
+        term.kind = NAME;
+        if (word.size() > 1 && word[0] == '!') {
+            term.negate = true;
+            word.erase(0, 1);
+        }
+
+        size_t split = word.find_first_of(":<>=");
+        std::string key = split == std::string::npos ? "" : word.substr(0, split);
+        if (key == "type" && word[split] == ':') {
+            std::string value = word.substr(split + 1);
+            if (value != "file" && value != "dir") throw std::invalid_argument("type must be file or dir");
+            term.kind = TYPE;
+            term.directory = value == "dir";
+        } else if (key == "ext" && word[split] == ':') {
+            term.kind = EXT;
+            std::string value = word.substr(split + 1);
+            if (!value.empty() && value[0] == '.') value.erase(0, 1);
+            if (value.empty()) throw std::invalid_argument("ext needs an extension");
+            term.text = "." + value;
+            for (char& c : term.text) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        } else if (key == "size" || key == "mtime") {
+            std::string rest = word.substr(split);
+            size_t opLength = rest.size() > 1 && rest[1] == '=' ? 2 : 1;
+            std::string op = rest.substr(0, opLength);
+            term.op = op == "<" ? LESS : op == "<=" ? LESS_EQUAL : op == ">" ? GREATER :
+                      op == ">=" ? GREATER_EQUAL : op == "=" ? EQUAL : throw std::invalid_argument(
+                          key + " needs <, <=, >, >= or =");
+            std::string value = rest.substr(opLength);
+            if (key == "size") {
+                term.kind = SIZE;
+                term.number = parseQuantity(value, "BKMGT", 1024, key);
+            } else {
+                term.kind = MTIME;
+                term.absoluteTime = parseDate(value, term.number);
+                if (!term.absoluteTime) term.number = parseDuration(value);
+            }
+        } else if (key == "path" && word[split] == ':') {
+            term.kind = PATH;
+            term.text = word.substr(split + 1);
+            if (!term.text.empty() && term.text[0] == '~') {
+#ifdef _WIN32
+                const char* home = std::getenv("USERPROFILE");
+#else
+                const char* home = std::getenv("HOME");
+#endif
+                if (home) term.text.replace(0, 1, home);
+            }
+        } else {
+            if (key == "name" && word[split] == ':') word.erase(0, split + 1);
+            term.kind = NAME;
+            term.pattern = std::make_shared<SearchPattern>(word);
+        }
+        return term;
+    }
+
+    // "1.5G" -> bytes; units are the letters of `units`, each `step` times
+    // the previous one (the first is 1)
+    static int64_t parseQuantity(const std::string& value, const char* units, double step,
+                                 const std::string& key) {
+        size_t used = 0;
+        double number;
+        try {
+            number = std::stod(value, &used);
+        } catch (const std::exception&) {
+            throw std::invalid_argument(key + " needs a number: " + value);
+        }
+        double factor = 1;
+        if (used < value.size()) {
+            const char* unit = std::strchr(units, std::toupper(static_cast<unsigned char>(value[used])));
+            if (!unit || used + 1 != value.size()) throw std::invalid_argument("unknown unit in " + value);
+            for (const char* u = units; u != unit; ++u) factor *= step;
+        }
+        return static_cast<int64_t>(number * factor);
+    }
+
+    static int64_t parseDuration(const std::string& value) {
+        static const std::pair<char, int64_t> units[] = {
+            {'s', 1}, {'m', 60}, {'h', 3600}, {'d', 86400}, {'w', 7 * 86400}};
+        size_t used = 0;
+        double number;
+        try {
+            number = std::stod(value, &used);
+        } catch (const std::exception&) {
+            throw std::invalid_argument("mtime needs an age (e.g. 30d) or a date (YYYY-MM-DD): " + value);
+        }
+        int64_t factor = 86400; // days by default
+        if (used < value.size()) {
+            auto it = std::find_if(std::begin(units), std::end(units),
+                                   [&](const auto& unit) { return unit.first == value[used]; });
+            if (it == std::end(units) || used + 1 != value.size()) {
+                throw std::invalid_argument("unknown unit in " + value);
+            }
+            factor = it->second;
+        }
+        return static_cast<int64_t>(number * static_cast<double>(factor));
+    }
+
+    // YYYY-MM-DD, as local midnight
+    static bool parseDate(const std::string& value, int64_t& time) {
+        std::tm date{};
+        std::istringstream in(value);
+        in >> std::get_time(&date, "%Y-%m-%d");
+        if (in.fail() || in.peek() != std::char_traits<char>::eof()) return false;
+        date.tm_isdst = -1;
+        time = static_cast<int64_t>(std::mktime(&date));
+        return true;
+    }
+};
+
+// ==================== Fuzzy Finder ====================
+// fzf-style matching: the characters of the query must appear in order in
+// the name (or, once the query contains a '/', in the path relative to the
+// root), and a match scores higher the more of it is consecutive or falls
+// at the start of a word. Each query refines the candidates left by the
+// previous one when it extends it, so typing a character only looks at what
+// still matched; deleting one goes back to the saved candidates.
+class FuzzyFinder {
+public:
+    static constexpr uint32_t noParent = UINT32_MAX;
+
+    struct Match {
+        uint32_t entry; // or, while matching names, the distinct name
+        int score;
+    };
+
+    explicit FuzzyFinder(unsigned threads = 1) : threads(std::max(1u, threads)) {}
+
+    // Entries are added parents first; returns the new entry
+    uint32_t add(std::string_view name, uint32_t parent) {
+        auto [it, added] = nameIndex.try_emplace(name, static_cast<uint32_t>(distinctNames.size()));
+        if (added) {
+            distinctNames.push_back(name);
+            nameBags.push_back(characterBag(name));
+        }
+        uint64_t bag = nameBags[it->second];
+        nameOf.push_back(it->second);
+        parents.push_back(parent);
+        pathBags.push_back(parent == noParent ? bag : bag | pathBags[parent]);
+        return static_cast<uint32_t>(nameOf.size() - 1);
+    }
+
+    // Copies the names given to add, which are otherwise only referenced,
+    // so the finder no longer depends on where they live
+    void ownNames() {
+        size_t total = 0;
+        for (std::string_view name : distinctNames) total += name.size();
+        ownedNames.resize(total);
+        char* out = ownedNames.data();
+        nameIndex.clear();
+        for (uint32_t id = 0; id < distinctNames.size(); ++id) {
+            std::copy(distinctNames[id].begin(), distinctNames[id].end(), out);
+            distinctNames[id] = std::string_view(out, distinctNames[id].size());
+            nameIndex.emplace(distinctNames[id], id);
+            out += distinctNames[id].size();
+        }
+    }
+
+    size_t size() const { return nameOf.size(); }
+    std::string_view name(uint32_t entry) const { return distinctNames[nameOf[entry]]; }
+
+    std::string relativePath(uint32_t entry) const {
+        std::string path;
+        if (parents[entry] != noParent) path = relativePath(parents[entry]) + '/';
+        path += name(entry);
+        return path;
+    }
+
+    // Returns the number of entries matching query and puts the best `top`
+    // of them, best first, in best. Case is ignored.
+    size_t search(const std::string& query, size_t top, std::vector<Match>& best) {
+        std::string folded;
+        for (char c : query) folded += lower(c);
+        bool pathMode = folded.find('/') != std::string::npos;
+        // A path query can match entries whose name does not, so it only
+        // refines earlier path queries
+        while (!levels.empty() && (folded.compare(0, levels.back().query.size(), levels.back().query) != 0 ||
+                                   (pathMode && !levels.back().pathMode))) {
+            levels.pop_back();
+        }
+        if (levels.empty() || levels.back().query != folded) {
+            const Level* from = levels.empty() || levels.back().query.empty() ? nullptr : &levels.back();
+            Level next{folded, pathMode, {}, 0, {}};
+            if (!folded.empty()) {
+                if (pathMode) {
+                    matchPaths(next, from);
+                } else {
+                    matchNames(next, from);
+                }
+            }
+            levels.push_back(std::move(next));
+        }
+
+        const Level& level = levels.back();
+        best.clear();
+        if (level.query.empty()) {
+            for (uint32_t entry = 0; entry < size() && best.size() < top; ++entry) {
+                best.push_back({entry, 0});
+            }
+            return size();
+        }
+        // Ties go to the shorter name, then to the earlier entry (distinct
+        // names are numbered in the order of their first entry)
+        auto better = [this](uint32_t (FuzzyFinder::*nameOfMatch)(uint32_t) const) {
+            return [this, nameOfMatch](const Match& a, const Match& b) {
+                if (a.score != b.score) return a.score > b.score;
+                size_t aLength = distinctNames[(this->*nameOfMatch)(a.entry)].size();
+                size_t bLength = distinctNames[(this->*nameOfMatch)(b.entry)].size();
+                if (aLength != bLength) return aLength < bLength;
+                return a.entry < b.entry;
+            };
+        };
+        if (level.pathMode) {
+            best.resize(std::min(top, level.matches.size()));
+            std::partial_sort_copy(level.matches.begin(), level.matches.end(), best.begin(), best.end(),
+                                   better(&FuzzyFinder::nameOfEntry));
+            return level.matches.size();
+        }
+
+        // Every entry with one of the best names, until there are enough
+        std::vector<Match> bestNames(std::min(top, level.names.size()));
+        std::partial_sort_copy(level.names.begin(), level.names.end(), bestNames.begin(), bestNames.end(),
+                               better(&FuzzyFinder::itself));
+        for (const Match& match : bestNames) {
+            for (uint32_t i = entriesStart[match.entry]; i < entriesStart[match.entry + 1] && best.size() < top; ++i) {
+                best.push_back({entriesByName[i], match.score});
+            }
+        }
+        return level.entries;
+    }
+
+    // The score of query (already lower case) in text, or -1 if its
+    // characters do not all appear in order. Like fzf's first algorithm:
+    // the first occurrence is found left to right, then narrowed from its
+    // end back to the latest start, and only that window is scored.
+    static int score(std::string_view text, std::string_view query) {
+        if (query.empty()) return 0;
+        size_t q = 0, end = 0;
+        for (size_t i = 0; i < text.size(); ++i) {
+            if (lower(text[i]) == query[q] && ++q == query.size()) {
+                end = i + 1;
+                break;
+            }
+        }
+        if (q < query.size()) return -1;
+        size_t start = end;
+        for (size_t remaining = query.size(); remaining > 0;) {
+            if (lower(text[--start]) == query[remaining - 1]) --remaining;
+        }
+
+        int total = 0;
+        bool previousMatched = false, inGap = false;
+        int previousBonus = 0;
+        q = 0;
+        for (size_t i = start; i < end; ++i) {
+            if (lower(text[i]) != query[q]) {
+                total -= inGap ? 1 : 3; // opening a gap costs more than widening it
+                inGap = true;
+                previousMatched = false;
+                continue;
+            }
+            int bonus = boundaryBonus(text, i);
+            if (previousMatched) bonus = std::max({bonus, previousBonus, 4});
+            total += 16 + (q == 0 ? 2 * bonus : bonus);
+            previousBonus = bonus;
+            previousMatched = true;
+            inGap = false;
+            ++q;
+        }
+        return total;
+    }
+
+private:
+    struct Level {
+        std::string query;
+        bool pathMode;
+        std::vector<Match> names;   // name queries: the matching distinct names
+        size_t entries = 0;         // ... and how many entries have them
+        std::vector<Match> matches; // path queries: the matching entries, in entry order
+    };
+
+    unsigned threads;
+    // Names repeat a lot in a tree (README.md, index.js, ...), so a name
+    // query scores each distinct name once and entries look theirs up
+    std::unordered_map<std::string_view, uint32_t> nameIndex;
+    std::vector<std::string_view> distinctNames;
+    std::vector<char> ownedNames;   // after ownNames, what distinctNames point into
+    std::vector<uint64_t> nameBags; // characterBag of each distinct name
+    std::vector<uint32_t> nameOf;   // per entry, its distinct name
+    std::vector<uint32_t> parents;
+    std::vector<uint64_t> pathBags; // the entry's name and every folder above it
+    std::vector<uint32_t> entriesStart, entriesByName; // the entries of each distinct name, in order
+    // The paths of the entries that are parents, built on the first path query
+    std::vector<uint32_t> folderOf; // per entry, its slot in folderPaths if it is a parent
+    std::vector<std::string> folderPaths;
+    std::vector<Level> levels;      // one per query typed, each refining the last
+
+    // One bit per letter or digit (ignoring case), the other characters
+    // sharing the rest; if the query's bag is not a subset of an entry's the
+    // entry cannot match, which one AND settles before any scoring
+    static uint64_t characterBag(std::string_view text) {
+        uint64_t bag = 0;
+        for (char c : text) bag |= characterBit(c);
+        return bag;
+    }
+
+    static uint64_t characterBit(char c) {
+        unsigned char u = static_cast<unsigned char>(lower(c));
+        if (u >= 'a' && u <= 'z') return uint64_t(1) << (u - 'a');
+        if (u >= '0' && u <= '9') return uint64_t(1) << (26 + u - '0');
+        return uint64_t(1) << (36 + u % 28);
+    }
+
+    static uint64_t bagOf(const std::string& query) {
+        uint64_t bag = 0;
+        for (char c : query) {
+            if (c != '/') bag |= characterBit(c);
+        }
+        return bag;
+    }
+
+    // ASCII case folding by table: std::tolower per character dominated
+    static char lower(char c) {
+        static const std::array<char, 256> table = [] {
+            std::array<char, 256> folded{};
+            for (int i = 0; i < 256; ++i) folded[i] = static_cast<char>(i >= 'A' && i <= 'Z' ? i + 32 : i);
+            return folded;
+        }();
+        return table[static_cast<unsigned char>(c)];
+    }
+
+    // fzf's bonuses: the start of the text or a path component counts most,
+    // then the start of a word or a camelCase hump
+    static int boundaryBonus(std::string_view text, size_t i) {
+        if (i == 0) return 9;
+        char previous = text[i - 1];
+        char current = text[i];
+        if (previous == '/' || previous == '\\') return 9;
+        if (previous == '_' || previous == '-' || previous == '.' || previous == ' ') return 8;
+        if (previous >= 'a' && previous <= 'z' && current >= 'A' && current <= 'Z') return 7;
+        if ((previous < '0' || previous > '9') && current >= '0' && current <= '9') return 7;
+        return 0;
+    }
+
+    uint32_t nameOfEntry(uint32_t entry) const { return nameOf[entry]; }
+    uint32_t itself(uint32_t name) const { return name; }
+
+    void matchNames(Level& level, const Level* from) {
+        if (entriesByName.size() != size()) { // a counting sort of the entries by name
+            entriesStart.assign(distinctNames.size() + 1, 0);
+            for (uint32_t name : nameOf) ++entriesStart[name + 1];
+            for (size_t name = 0; name < distinctNames.size(); ++name) entriesStart[name + 1] += entriesStart[name];
+            entriesByName.resize(size());
+            std::vector<uint32_t> next(entriesStart.begin(), entriesStart.end() - 1);
+            for (uint32_t entry = 0; entry < size(); ++entry) entriesByName[next[nameOf[entry]]++] = entry;
+        }
+
+        uint64_t required = bagOf(level.query);
+        level.names = collect(from ? from->names.size() : distinctNames.size(), [&](size_t i, auto& out) {
+            uint32_t id = from ? from->names[i].entry : static_cast<uint32_t>(i);
+            if ((nameBags[id] & required) != required) return;
+            int points = score(distinctNames[id], level.query);
+            if (points >= 0) out.push_back({id, points});
+        });
+        for (const Match& name : level.names) {
+            level.entries += entriesStart[name.entry + 1] - entriesStart[name.entry];
+        }
+    }
+
+    void matchPaths(Level& level, const Level* from) {
+        if (folderOf.size() != size()) { // parents come before their entries
+            folderOf.assign(size(), noParent);
+            folderPaths.clear();
+            for (uint32_t parent : parents) {
+                if (parent != noParent) folderOf[parent] = 0;
+            }
+            for (uint32_t entry = 0; entry < size(); ++entry) {
+                if (folderOf[entry] == noParent) continue;
+                folderOf[entry] = static_cast<uint32_t>(folderPaths.size());
+                std::string path = parents[entry] == noParent ? std::string()
+                                                              : folderPaths[folderOf[parents[entry]]] + '/';
+                folderPaths.push_back(path.append(name(entry)));
+            }
+        }
+
+        uint64_t required = bagOf(level.query);
+        level.matches = collect(from ? from->matches.size() : size(), [&](size_t i, auto& out) {
+            uint32_t entry = from ? from->matches[i].entry : static_cast<uint32_t>(i);
+            if ((pathBags[entry] & required) != required) return;
+            thread_local std::string path;
+            path.clear();
+            if (parents[entry] != noParent) path.append(folderPaths[folderOf[parents[entry]]]).push_back('/');
+            path.append(name(entry));
+            int points = score(path, level.query);
+            if (points >= 0) out.push_back({entry, points});
+        });
+    }
+
+    // Runs keep(i, out) for every i below count and returns what it pushed
+    // to out, in order of i; large counts are split over the threads
+    template <typename Keep>
+    std::vector<Match> collect(size_t count, Keep keep) const {
+        size_t workers = std::min<size_t>(threads, std::max<size_t>(1, count / 65536));
+        std::vector<std::vector<Match>> parts(workers);
+        size_t chunk = (count + workers - 1) / workers;
+        auto run = [&](size_t w) {
+            for (size_t i = w * chunk; i < std::min(count, (w + 1) * chunk); ++i) keep(i, parts[w]);
+        };
+        std::vector<std::thread> pool;
+        for (size_t w = 1; w < workers; ++w) pool.emplace_back(run, w);
+        run(0);
+        for (std::thread& worker : pool) worker.join();
+
+        std::vector<Match> matches = std::move(parts[0]);
+        for (size_t w = 1; w < workers; ++w) {
+            matches.insert(matches.end(), parts[w].begin(), parts[w].end());
+        }
+        return matches;
+    }
+};
+
+// ==================== Search Cache ====================
+// Recent name searches and queries with their results, so that repeating
+// one, or narrowing it, does not walk the tree again. Results belong to a
+// contentGeneration of the tree and are only used while it is current; the
+// tree also drops them all (forgetResults) before it releases any node, so
+// no cached Node* outlives its item. The compiled pattern or query is kept
+// regardless, with what it remembered per name. The least recently used
+// entries go first once there are more than `capacity` of them or more
+// than `maxResults` results in all.
+class SearchCache {
+public:
+    struct Entry {
+        std::string key;
+        std::shared_ptr<SearchPattern> pattern; // name searches
+        std::shared_ptr<TreeQuery> query;       // queries
+        std::vector<Node*> results;
+        uint64_t generation = UINT64_MAX;       // contentGeneration the results belong to
+        bool complete = false;                  // false if a limit cut the search short
+
+        bool fresh(uint64_t current) const { return generation == current; }
+
+        // True if the results answer a search with this limit
+        bool answers(uint64_t current, size_t limit) const {
+            return fresh(current) && (complete || (limit && results.size() >= limit));
+        }
+    };
+
+    explicit SearchCache(size_t capacity = 32, size_t maxResults = size_t(1) << 22)
+        : capacity(capacity), maxResults(maxResults) {}
+
+    // The entry for key, now the most recently used; a new one has no
+    // pattern, query or results yet
+    Entry& lookup(const std::string& key) {
+        auto it = byKey.find(key);
+        if (it != byKey.end()) {
+            entries.splice(entries.begin(), entries, it->second);
+            return entries.front();
+        }
+        entries.emplace_front();
+        entries.front().key = key;
+        byKey.emplace(key, entries.begin());
+        trim();
+        return entries.front();
+    }
+
+    // Keeps the results of a search in the entry lookup returned for it
+    void store(Entry& entry, const std::vector<Node*>& results, uint64_t generation, bool complete) {
+        if (results.size() > maxResults) return; // would push out everything else
+        entry.results = results;
+        entry.generation = generation;
+        entry.complete = complete;
+        trim();
+    }
+
+    // Of the fresh, complete entries for which covers(entry) holds, the one
+    // with the fewest results, or nullptr
+    template <typename Covers>
+    const Entry* narrowest(uint64_t generation, Covers covers) const {
+        const Entry* best = nullptr;
+        for (const Entry& entry : entries) {
+            if (!entry.answers(generation, 0) || !covers(entry)) continue;
+            if (!best || entry.results.size() < best->results.size()) best = &entry;
+        }
+        return best;
+    }
+
+    void forgetResults() {
+        for (Entry& entry : entries) {
+            std::vector<Node*>().swap(entry.results);
+            entry.generation = UINT64_MAX;
+            entry.complete = false;
+        }
+    }
+
+private:
+    size_t capacity;
+    size_t maxResults;
+    std::list<Entry> entries; // most recently used first
+    std::unordered_map<std::string, std::list<Entry>::iterator> byKey;
+
+    // Never evicts the most recently used entry, which the caller holds
+    void trim() {
+        size_t total = 0;
+        for (const Entry& entry : entries) total += entry.results.size();
+        while (entries.size() > 1 && (entries.size() > capacity || total > maxResults)) {
+            total -= entries.back().results.size();
+            byKey.erase(entries.back().key);
+            entries.pop_back();
+        }
+    }
+};
+
+// ==================== Enhanced FileSystemTree Class ====================
+class FileSystemTree {
+public:
+    enum ScanBackend { THREAD_POOL, IO_URING };
+
+    NodeArena arena; // owns every Node of the tree
+    Node* root = nullptr;
+    std::string currentSearchTerm;
+    std::vector<Node*> searchResults;
+    unsigned scanThreads = 0; // 0 = one worker per hardware thread
+    bool trigramSearch = false; // answer searches from a TrigramIndex where possible
+    ScanBackend scanBackend = THREAD_POOL;
+    fs::path snapshotPath;    // empty = snapshots disabled
+    std::unique_ptr<MappedSnapshot> snapshot; // backs lazy nodes after loadSnapshot
+    std::mutex mutex; // held by whoever reads or changes the tree while a TreeWatcher runs
+    uint64_t generation = 0; // bumped by every change to the tree, lazy loads included
+    uint64_t contentGeneration = 0; // bumped when items are added, removed or changed
+
+    FileSystemTree() = default;
+
+    // Scans currentPath into `into`; returns the new root, or nullptr. With a
+    // parent the result is a subtree for it, to be inserted by the caller.
+    // Directories come with their SubtreeTotals filled in.
+    Node* buildTree(const fs::path& currentPath, NodeArena& into, bool showProgress = true,
+                    Node* parent = nullptr) {
+        Node* built = scanTree(currentPath, into, showProgress, parent);
+        if (built) computeTotals(built, into, scanThreads);
+        return built;
+    }
+
+    // Bytes and files below node (or node itself, for a file) and the
+    // newest of them, in O(1): directories keep their totals up to date
+    SubtreeTotals subtreeTotals(const Node* node) const {
+        if (node->type == Node::DIRECTORY) return node->children.totals();
+        return {node->size(), 1, node->lastModified};
+    }
+
+    // Fills in the totals of every directory of a freshly built subtree,
+    // bottom-up: the subtrees a few levels down are summed on separate
+    // threads, then the levels above them. Each directory is written by one
+    // thread only, and one with files has its child list header already.
+    static SubtreeTotals computeTotals(Node* subtree, NodeArena& arena, unsigned threads) {
+        if (subtree->type != Node::DIRECTORY) return {subtree->size(), 1, subtree->lastModified};
+        if (!threads) threads = ParallelScanner::defaultWorkers();
+
+        // Split the top levels off until there are enough subtrees to share
+        std::vector<Node*> upper; // in breadth-first order
+        std::vector<Node*> frontier{subtree};
+        while (threads > 1 && frontier.size() < threads * 8) {
+            std::vector<Node*> next;
+            for (Node* dir : frontier) {
+                for (Node* child : dir->children) {
+                    if (child->type == Node::DIRECTORY && !child->lazy) next.push_back(child);
+                }
+            }
+            if (next.empty()) break;
+            upper.insert(upper.end(), frontier.begin(), frontier.end());
+            frontier = std::move(next);
+        }
+
+        std::atomic<size_t> nextTask{0};
+        auto work = [&] {
+            for (size_t i; (i = nextTask.fetch_add(1)) < frontier.size();) sumSubtree(frontier[i], arena);
+        };
+        std::vector<std::thread> pool;
+        for (unsigned i = 1; i < std::min<size_t>(threads, frontier.size()); ++i) pool.emplace_back(work);
+        work();
+        for (std::thread& worker : pool) worker.join();
+
+        for (auto it = upper.rbegin(); it != upper.rend(); ++it) {
+            (*it)->children.setTotals(arena, sumChildren(*it));
+        }
+        return subtree->children.totals();
+    }
+
+    // Replaces the whole tree with a fresh scan of path. The new tree gets
+    // its own arena, so the old one is freed slab by slab.
+    bool rebuild(const fs::path& path, bool showProgress = true) {
+        NodeArena fresh;
+        Node* built = buildTree(path, fresh, showProgress);
+        searchResults.clear();
+        searchCache.forgetResults();
+        names.clear();
+        root = built;
+        arena = std::move(fresh);
+        if (root) names.addSubtree(root);
+        markChanged();
+        return root != nullptr;
+    }
+
+    // Maps the snapshot for startPath and rescans only the directories whose
+    // mtime changed since it was written. Everything else stays in the
+    // mapping until it is needed: the root starts out lazy and directories
+    // are materialized on demand by ensureLoaded. Returns false if there is
+    // no usable snapshot, in which case the caller does a full build.
+    bool loadSnapshot(const fs::path& startPath) {
+        if (snapshotPath.empty()) return false;
+
+        auto start = std::chrono::steady_clock::now();
+        trigrams.forgetSnapshot();
+        snapshot = MappedSnapshot::open(snapshotPath, startPath);
+        if (!snapshot) return false;
+
+        searchResults.clear();
+        searchCache.forgetResults();
+        arena = NodeArena();
+        root = arena.makeRoot(startPath, Node::DIRECTORY, snapshot->info(0));
+        root->snapshotIndex = 0;
+        root->lazy = snapshot->end(0) > 1;
+        root->children.setTotals(arena, snapshot->totals(0));
+        names.clear();
+        names.add(root);
+        markChanged();
+
+        RefreshStats stats;
+        if (!refreshSubtree(root, stats)) { // root itself is gone
+            root = nullptr;
+            names.clear();
+            arena = NodeArena();
+            snapshot.reset();
+            trigrams.forgetSnapshot();
+            return false;
+        }
+
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        std::cout << "Loaded snapshot " << snapshotPath << " (" << stats.directoriesRescanned
+                  << " changed directories rescanned, " << elapsed << "ms)\n";
+        return true;
+    }
+
+    struct RefreshStats {
+        size_t directoriesChecked = 0;
+        size_t directoriesRescanned = 0;
+        std::vector<Node*> addedDirectories; // new subtrees, scanned in full
+    };
+
+    // Incremental Refresh Tree: see refreshSubtree. Returns false if the
+    // root directory no longer exists.
+    bool refresh(RefreshStats& stats) {
+        return root && refreshSubtree(root, stats);
+    }
+
+    // Compares the mtime and inode of every directory under dir with the
+    // ones recorded in its Node (or snapshot record, for lazy subtrees) and
+    // re-lists only those that differ, reconciling their children in place.
+    // A directory's mtime changes when entries are added, removed or
+    // renamed in it, so an unchanged tree costs one stat per directory.
+    // Sizes of files in unchanged directories are not re-read. Returns false
+    // if dir no longer exists (or is no longer a directory).
+    bool refreshSubtree(Node* dir, RefreshStats& stats) {
+        FileStat info = statNoFollow(dir->path());
+        if (!info.exists) return false;
+        if (info.isSymlink) return true; // never descended into
+        if (!info.isDirectory) return false;
+        ++stats.directoriesChecked;
+
+        bool changed = info.lastModified != dir->lastModified ||
+                       (info.inode && dir->inode() && info.inode != dir->inode());
+
+        if (!changed && dir->lazy && snapshot) {
+            std::vector<uint32_t> changedRecords;
+            if (findChangedDirectories(dir->snapshotIndex, dir->path(), changedRecords,
+                                       stats.directoriesChecked)) {
+                for (uint32_t index : changedRecords) {
+                    if (Node* changedDir = materializeRecord(index)) {
+                        refreshSubtree(changedDir, stats);
+                    }
+                }
+                return true;
+            }
+            changed = true; // A subdirectory vanished without the mtime moving
+        }
+
+        std::vector<Node*> keptDirectories;
+        if (!changed) {
+            for (Node* child : dir->children) {
+                if (child->type == Node::DIRECTORY && !refreshSubtree(child, stats)) {
+                    changed = true; // Vanished or replaced without the mtime moving
+                }
+            }
+            if (!changed) return true;
+            reconcileDirectory(dir, stats, keptDirectories);
+            keptDirectories.clear(); // Those were just refreshed above
+        } else {
+            reconcileDirectory(dir, stats, keptDirectories);
+        }
+        dir->setInfo(info);
+        markChanged();
+
+        for (Node* child : keptDirectories) {
+            refreshSubtree(child, stats);
+        }
+        return true;
+    }
+
+    // Node for an absolute path inside the tree, or nullptr. Lazy
+    // directories along the way are materialized.
+    Node* resolvePath(const fs::path& path) {
+        if (!root) return nullptr;
+        fs::path relative = path.lexically_relative(root->path());
+        if (relative.empty() || *relative.begin() == "..") return nullptr;
+
+        Node* node = root;
+        for (const auto& component : relative) {
+            if (component == "." || component.empty()) continue;
+            ensureLoaded(node);
+            node = findChild(node, component.string());
+            if (!node) return nullptr;
         }
+        return node;
     }
 
-    void addChild(std::unique_ptr<Node> child) {
-        if (type == DIRECTORY) {
-            children.push_back(std::move(child));
-        } else {
-            std::cerr << "Error: Cannot add children to a file node.\n";
-        }
+    // The inverse of findByRelativePath, with '/' separators; empty for
+    // the root itself
+    std::string relativePathOf(const Node* node) const {
+        return node == root ? std::string() : node->path().lexically_relative(root->path()).generic_string();
     }
 
-    void print(int indent = 0, bool showDetails = false) const {
-        std::cout << std::string(indent * 2, ' ')
-                  << (type == DIRECTORY ? "📁 " : "📄 ")
-                  << name;
+    // Node for a path relative to the root directory ("src/util/io.cpp"),
+    // or nullptr. Costs one child lookup per path component.
+    Node* findByRelativePath(const std::string& relativePath) {
+        if (!root) return nullptr;
+        return resolvePath(root->path() / fs::path(relativePath));
+    }
 
-        if (showDetails) {
-            std::cout << "  " << formatSize(size) << "  "
-                      << formatTime(lastModified);
+    // Brings the node for `path` in line with the disk: adds, updates or
+    // removes it. A new directory is scanned in full and returned, so that
+    // watchers can subscribe to it; otherwise returns nullptr.
+    Node* syncEntry(const fs::path& path) {
+        Node* parent = resolvePath(path.parent_path());
+        if (!parent || parent->type != Node::DIRECTORY) {
+            return nullptr; // Unknown parent; syncing the parent covers this entry
         }
+        ensureLoaded(parent);
 
-        std::cout << "\n";
+        std::string entryName = path.filename().string();
+        Node* existing = findChild(parent, entryName);
 
-        for (const auto& child : children) {
-            child->print(indent + 1, showDetails);
-        }
-    }
+        FileStat link = statNoFollow(path);
+        FileStat info = link.isSymlink ? statPath(path) : link;
+        Node* added = nullptr;
 
-    static std::string formatSize(uintmax_t bytes) {
-        constexpr const char* sizes[] = {"B", "KB", "MB", "GB"};
-        double size = bytes;
-        int i = 0;
-        while (size >= 1024 && i < 3) {
-            size /= 1024;
-            i++;
+        if (!link.exists) {
+            if (existing) detachChild(parent, existing);
+        } else if (existing && (existing->type == Node::DIRECTORY) == info.isDirectory) {
+            if (existing->type == Node::FILE) updateFileInfo(existing, &info);
+        } else {
+            if (existing) detachChild(parent, existing);
+            Node* node;
+            if (info.isDirectory && !link.isSymlink) {
+                node = buildTree(path, arena, false, parent);
+                added = node;
+            } else {
+                node = arena.makeChild(parent, entryName,
+                    info.isDirectory ? Node::DIRECTORY : Node::FILE, info);
+            }
+            if (node) insertChild(parent, node);
         }
-        std::ostringstream oss;
-        oss << std::fixed << std::setprecision(2) << size << sizes[i];
-        return oss.str();
-    }
 
-    static std::string formatTime(time_t time) {
-        char buffer[80];
-        std::strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", std::localtime(&time));
-        return buffer;
+        // Directory mtimes, the parent's included, are left alone: one must
+        // only move once all of the directory's contents were synced, or
+        // refreshSubtree would miss those this event did not cover. A stale
+        // one only costs a rescan of that directory. The newest time below
+        // the parent is kept up to date by the totals.
+        markChanged();
+        return added;
     }
-};
-
-// ==================== Enhanced FileSystemTree Class ====================
-class FileSystemTree {
-public:
-    std::unique_ptr<Node> root;
-    std::string currentSearchTerm;
-    std::vector<Node*> searchResults;
 
-    FileSystemTree() = default;
+    // Absolute paths of dir and every directory below it, including those
+    // still inside lazy snapshot subtrees (which are not materialized)
+    void collectDirectories(const Node* dir, std::vector<fs::path>& paths) const {
+        if (dir->type != Node::DIRECTORY) return;
+        paths.push_back(dir->path());
 
-    std::unique_ptr<Node> buildTree(const fs::path& currentPath) {
-        if (!fs::exists(currentPath)) {
-            std::cerr << "Error: Path does not exist: " << currentPath << "\n";
-            return nullptr;
+        if (dir->lazy && snapshot) {
+            std::vector<std::pair<uint32_t, fs::path>> ancestors{{dir->snapshotIndex, paths.back()}};
+            for (uint32_t i = dir->snapshotIndex + 1; i < snapshot->end(dir->snapshotIndex); ++i) {
+                while (i >= snapshot->end(ancestors.back().first)) ancestors.pop_back();
+                if (!snapshot->isDirectory(i)) continue;
+                paths.push_back(ancestors.back().second / snapshot->name(i));
+                ancestors.emplace_back(i, paths.back());
+            }
+            return;
+        }
+        for (const Node* child : dir->children) {
+            collectDirectories(child, paths);
         }
+    }
 
-        std::unique_ptr<Node> currentNode;
-        try {
-            if (fs::is_directory(currentPath)) {
-                currentNode = std::make_unique<Node>(
-                    currentPath.filename().string(), currentPath, Node::DIRECTORY);
+    void saveSnapshot() {
+        if (snapshotPath.empty() || !root) return;
+#ifdef _WIN32
+        // Windows cannot replace a file that is still mapped
+        if (snapshot) {
+            materializeAll(root);
+            snapshot.reset();
+            trigrams.forgetSnapshot();
+        }
+#endif
+        TreeSnapshot::save(root, snapshot.get(), snapshotPath);
+    }
 
-                // Show loading progress for large directories
-                size_t itemCount = 0;
-                auto startTime = std::chrono::steady_clock::now();
+    // Drops the mapped snapshot once nothing refers to it (e.g. after the
+    // whole tree was rebuilt)
+    void releaseSnapshot() {
+        snapshot.reset();
+        trigrams.forgetSnapshot();
+    }
 
-                for (const auto& entry : fs::directory_iterator(currentPath)) {
-                    try {
-                        auto childNode = buildTree(entry.path());
-                        if (childNode) {
-                            currentNode->addChild(std::move(childNode));
-                            itemCount++;
-
-                            // Show progress every 100 items
-                            if (itemCount % 100 == 0) {
-                                auto now = std::chrono::steady_clock::now();
-                                auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - startTime).count();
-                                std::cout << "\rLoading... " << itemCount << " items ("
-                                          << elapsed << "ms)";
-                                std::cout.flush();
-                            }
-                        }
-                    } catch (...) {
-                        continue; // Skip problematic entries
-                    }
-                }
+    // Creates Nodes for the children of a lazy directory from the snapshot
+    void ensureLoaded(Node* dir) {
+        if (!dir || !dir->lazy || !snapshot) return;
 
-                if (itemCount >= 100) {
-                    std::cout << "\r" << std::string(50, ' ') << "\r"; // Clear line
-                }
-            } else {
-                currentNode = std::make_unique<Node>(
-                    currentPath.filename().string(), currentPath);
-            }
-        } catch (...) {
-            std::cerr << "Error building tree for: " << currentPath << "\n";
-            return nullptr;
+        uint32_t index = dir->snapshotIndex;
+        dir->children.reserve(arena, snapshot->record(index).childCount);
+        for (uint32_t i = index + 1; i < snapshot->end(index); i = snapshot->end(i)) {
+            Node* child = arena.makeChild(dir, snapshot->name(i),
+                snapshot->isDirectory(i) ? Node::DIRECTORY : Node::FILE, snapshot->info(i));
+            child->snapshotIndex = i;
+            child->lazy = snapshot->end(i) > i + 1;
+            if (child->lazy) child->children.setTotals(arena, snapshot->totals(i));
+            dir->children.push_back(arena, child);
+            names.add(child);
         }
-
-        return currentNode;
+        dir->lazy = false;
+        names.markLoaded(dir);
+        ++generation; // Same items as before, so contentGeneration stays
     }
 
     void displayTree(bool showDetails = false) const {
-        if (root) {
-            root->print(0, showDetails);
-        } else {
+        if (!root) {
             std::cout << "Tree is empty.\n";
+            return;
+        }
+        const TreeColumns& view = columnView();
+        for (size_t row = 0; row < view.rows(); ++row) {
+            int indent = view.depth[row];
+            Node::printLine(indent, view.flags[row] & TreeColumns::DIRECTORY_ROW, view.name(row),
+                            view.size[row], view.lastModified[row], showDetails,
+                            view.node[row]->children.totals().files);
+            if ((view.flags[row] & TreeColumns::LAZY_ROW) && snapshot) {
+                snapshot->printSubtree(view.node[row]->snapshotIndex, indent + 1, showDetails);
+            }
         }
     }
 
+    // A node named targetName in current's subtree, or nullptr. Loaded
+    // nodes come from the name index, oldest first; failing that, lazy
+    // snapshot subtrees are searched and the match is materialized.
     Node* findNode(Node* current, const std::string& targetName) {
         if (!current) return nullptr;
-        if (current->name == targetName) return current;
+        if (!current->parent && current->name() == targetName) return current; // Root
 
-        for (const auto& child : current->children) {
-            Node* found = findNode(child.get(), targetName);
-            if (found) return found;
+        NamePool::Id target;
+        if (NamePool::instance().lookup(targetName, target)) {
+            for (Node* node : names.find(target)) {
+                if (isWithin(node, current)) return node;
+            }
+        }
+
+        if (!snapshot) return nullptr;
+        for (Node* dir : names.lazy()) {
+            if (!isWithin(dir, current)) continue;
+            uint32_t index = snapshot->findInSubtree(dir->snapshotIndex, targetName);
+            if (index != MappedSnapshot::npos) return materializeRecord(index);
         }
         return nullptr;
     }
 
-    Node* findParent(Node* current, Node* targetChild) {
-        if (!current || current->type != Node::DIRECTORY) return nullptr;
+    // Every node named targetName, so the caller can let the user choose.
+    // Matches still inside lazy snapshot subtrees are materialized first.
+    std::vector<Node*> findNodes(const std::string& targetName) {
+        std::vector<Node*> matches;
+        if (!root) return matches;
+        if (root->name() == targetName) matches.push_back(root);
 
-        for (const auto& child : current->children) {
-            if (child.get() == targetChild) return current;
-            if (child->type == Node::DIRECTORY) {
-                Node* found = findParent(child.get(), targetChild);
-                if (found) return found;
+        if (snapshot) {
+            std::vector<uint32_t> hits;
+            for (const Node* dir : names.lazy()) {
+                uint32_t index = dir->snapshotIndex;
+                for (uint32_t i = index + 1; i < snapshot->end(index); ++i) {
+                    if (snapshot->name(i) == targetName) hits.push_back(i);
+                }
+            }
+            for (uint32_t hit : hits) {
+                materializeRecord(hit); // which adds it to the index
             }
         }
-        return nullptr;
+
+        NamePool::Id target;
+        if (NamePool::instance().lookup(targetName, target)) {
+            const std::vector<Node*>& found = names.find(target);
+            matches.insert(matches.end(), found.begin(), found.end());
+        }
+        return matches;
+    }
+
+    // Nodes record their parent, so this no longer searches the tree
+    Node* findParent(const Node* targetChild) const {
+        return targetChild ? targetChild->parent : nullptr;
     }
 
     bool deleteNode(Node* parent, Node* targetNode) {
@@ -213,26 +3828,21 @@ public:
 
         try {
             if (targetNode->type == Node::DIRECTORY) {
-                success = fs::remove_all(targetNode->fullPath, ec) > 0;
+                success = fs::remove_all(targetNode->path(), ec) > 0;
             } else {
-                success = fs::remove(targetNode->fullPath, ec);
+                success = fs::remove(targetNode->path(), ec);
             }
 
             if (success) {
-                std::cout << "Successfully removed: " << targetNode->fullPath << "\n";
-                // Remove from parent's children
-                auto& children = parent->children;
-                children.erase(std::remove_if(children.begin(), children.end(),
-                    [targetNode](const std::unique_ptr<Node>& child) {
-                        return child.get() == targetNode;
-                    }), children.end());
+                std::cout << "Successfully removed: " << targetNode->path() << "\n";
+                detachChild(parent, targetNode);
                 return true;
             }
         } catch (...) {
             ec = std::error_code(errno, std::generic_category());
         }
 
-        std::cerr << "Error removing " << targetNode->fullPath
+        std::cerr << "Error removing " << targetNode->path()
                   << ": " << ec.message() << "\n";
         return false;
     }
@@ -243,15 +3853,16 @@ public:
             return nullptr;
         }
 
-        fs::path newDirPath = parent->fullPath / newFolderName;
+        ensureLoaded(parent);
+        fs::path newDirPath = parent->path() / newFolderName;
         std::error_code ec;
 
         if (fs::create_directory(newDirPath, ec)) {
             std::cout << "Created directory: " << newDirPath << "\n";
-            auto newNode = std::make_unique<Node>(newFolderName, newDirPath, Node::DIRECTORY);
-            auto* rawPtr = newNode.get();
-            parent->children.push_back(std::move(newNode));
-            return rawPtr;
+            Node* newNode = arena.makeChild(parent, newFolderName, Node::DIRECTORY, FileStat{});
+            newNode->updateFileInfo();
+            insertChild(parent, newNode);
+            return newNode;
         }
 
         std::cerr << "Error creating directory: " << newDirPath
@@ -265,17 +3876,23 @@ public:
             return nullptr;
         }
 
-        fs::path newFilePath = parent->fullPath / newFileName;
+        ensureLoaded(parent);
+        fs::path newFilePath = parent->path() / newFileName;
 
         try {
             std::ofstream ofs(newFilePath);
             if (ofs) {
                 ofs.close();
                 std::cout << "Created file: " << newFilePath << "\n";
-                auto newNode = std::make_unique<Node>(newFileName, newFilePath);
-                auto* rawPtr = newNode.get();
-                parent->children.push_back(std::move(newNode));
-                return rawPtr;
+                if (Node* existing = findChild(parent, newFileName)) { // Was truncated
+                    updateFileInfo(existing);
+                    markChanged();
+                    return existing;
+                }
+                Node* newNode = arena.makeChild(parent, newFileName, Node::FILE, FileStat{});
+                newNode->updateFileInfo();
+                insertChild(parent, newNode);
+                return newNode;
             }
         } catch (...) {
             std::error_code ec(errno, std::generic_category());
@@ -292,35 +3909,38 @@ public:
             return false;
         }
 
-        fs::path newFullPath = newParent->fullPath / newName;
+        ensureLoaded(newParent);
+        fs::path newFullPath = newParent->path() / newName;
         std::error_code ec;
 
         try {
-            fs::rename(targetNode->fullPath, newFullPath, ec);
+            fs::rename(targetNode->path(), newFullPath, ec);
             if (ec) throw std::runtime_error(ec.message());
 
+            // A file that was there has just been replaced
+            Node* replaced = findChild(newParent, newName);
+            if (replaced && replaced != targetNode) detachChild(newParent, replaced);
+
             // Update the node's properties
-            targetNode->name = newName;
-            targetNode->fullPath = newFullPath;
-            targetNode->updateFileInfo();
+            // Descendants need no update: their paths go through this node,
+            // and neither do their index entries
+            names.remove(targetNode);
+            targetNode->rename(newName);
 
-            // If moved to a different parent, update parent-child relationships
-            Node* oldParent = findParent(root.get(), targetNode);
-            if (oldParent && oldParent != newParent) {
-                // Find and transfer the unique_ptr from old parent to new parent
-                std::unique_ptr<Node> nodeToMove;
+            // Take it out of the old parent's children and put it back at
+            // its place in the new parent's name order
+            if (Node* oldParent = findParent(targetNode)) {
                 auto& oldChildren = oldParent->children;
-                for (auto it = oldChildren.begin(); it != oldChildren.end(); ++it) {
-                    if (it->get() == targetNode) {
-                        nodeToMove = std::move(*it);
-                        oldChildren.erase(it);
-                        break;
-                    }
-                }
-                if (nodeToMove) {
-                    newParent->children.push_back(std::move(nodeToMove));
-                }
+                auto it = std::find(oldChildren.begin(), oldChildren.end(), targetNode);
+                if (it != oldChildren.end()) oldChildren.erase(it);
+                adjustTotals(oldParent, {}, subtreeTotals(targetNode));
             }
+            targetNode->parent = newParent;
+            placeChild(newParent, targetNode);
+            names.add(targetNode);
+            targetNode->updateFileInfo();
+            adjustTotals(newParent, subtreeTotals(targetNode), {});
+            markChanged();
 
             std::cout << "Successfully renamed/moved to: " << newFullPath << "\n";
             return true;
@@ -341,7 +3961,8 @@ public:
             return nullptr;
         }
 
-        fs::path destinationFilePath = destinationParent->fullPath / sourceFilePath.filename();
+        ensureLoaded(destinationParent);
+        fs::path destinationFilePath = destinationParent->path() / sourceFilePath.filename();
         std::error_code ec;
 
         try {
@@ -349,28 +3970,29 @@ public:
                     fs::copy_options::overwrite_existing, ec);
             if (ec) throw std::runtime_error(ec.message());
 
-            auto newNode = std::make_unique<Node>(
-                sourceFilePath.filename().string(), destinationFilePath);
-            auto* rawPtr = newNode.get();
-            destinationParent->children.push_back(std::move(newNode));
-
             std::cout << "Successfully imported: " << destinationFilePath << "\n";
-            return rawPtr;
+            if (Node* existing = findChild(destinationParent, sourceFilePath.filename().string())) {
+                updateFileInfo(existing); // Overwritten
+                markChanged();
+                return existing;
+            }
+            Node* newNode = arena.makeChild(destinationParent, sourceFilePath.filename().string(),
+                                            Node::FILE, FileStat{});
+            newNode->updateFileInfo();
+            insertChild(destinationParent, newNode);
+            return newNode;
         } catch (...) {
             std::cerr << "Error importing file: " << ec.message() << "\n";
             return nullptr;
         }
     }
 
-    void openFile(Node* targetFileNode) {
-        if (!targetFileNode || targetFileNode->type != Node::FILE) {
-            std::cerr << "Error: Invalid file node.\n";
-            return;
-        }
-
-        std::cout << "\n--- Opening: " << targetFileNode->fullPath << " ---\n";
+    // Takes a path rather than a node: paging through a file waits for the
+    // user, which must not happen under the tree mutex
+    void openFile(const fs::path& filePath) {
+        std::cout << "\n--- Opening: " << filePath << " ---\n";
 
-        std::string extension = targetFileNode->fullPath.extension().string();
+        std::string extension = filePath.extension().string();
         std::transform(extension.begin(), extension.end(), extension.begin(),
                        [](unsigned char c){ return std::tolower(c); });
 
@@ -381,50 +4003,643 @@ public:
         };
 
         if (std::find(textExtensions.begin(), textExtensions.end(), extension) != textExtensions.end()) {
-            displayFileContent(targetFileNode->fullPath);
+            displayFileContent(filePath);
         } else {
-            openWithDefaultApp(targetFileNode->fullPath);
+            openWithDefaultApp(filePath);
+        }
+    }
+
+    // Searches the whole tree on scanThreads workers. Each match is added
+    // to searchResults and passed to onMatch as soon as it is found, so the
+    // order is not that of the tree; with a limit the search stops after
+    // that many matches. A search repeated while the tree is unchanged is
+    // answered from the cache, and so is one for text that contains the
+    // text of a cached one (rep, then report): only its results are tested.
+    void searchFiles(const std::string& pattern, size_t limit = 0,
+                     const std::function<void(const Node*)>& onMatch = nullptr) {
+        searchResults.clear();
+        currentSearchTerm = pattern;
+        if (!root) return;
+
+        try {
+            SearchCache::Entry& cached = searchCache.lookup("name:" + pattern);
+            if (!cached.pattern) {
+                cached.pattern = std::make_shared<SearchPattern>(pattern); // A bad pattern is reported before any walking
+            }
+            if (replayCached(cached, limit, onMatch)) return;
+
+            SearchPattern& matcher = *cached.pattern;
+            const SearchCache::Entry* wider = nullptr;
+            if (matcher.mode() == SearchPattern::LITERAL) {
+                wider = searchCache.narrowest(contentGeneration, [&](const SearchCache::Entry& entry) {
+                    return entry.pattern && entry.pattern->mode() == SearchPattern::LITERAL &&
+                           matcher.literal().find(entry.pattern->literal()) != std::string::npos;
+                });
+            }
+            if (wider) {
+                for (Node* node : wider->results) {
+                    bool match = node->parent ? matcher.matches(NamePool::Id(node->nameId))
+                                              : matcher.matches(node->name());
+                    if (match && report(node, limit, onMatch)) break;
+                }
+            } else {
+                sweepNames(matcher, limit, onMatch);
+            }
+            searchCache.store(cached, searchResults, contentGeneration,
+                              !limit || searchResults.size() < limit);
+        } catch (const std::regex_error& e) {
+            std::cerr << "Invalid search pattern: " << e.what() << "\n";
         }
     }
 
-    void searchFiles(const std::string& pattern, Node* current = nullptr) {
-        if (!current) {
-            current = root.get();
-            searchResults.clear();
-            currentSearchTerm = pattern;
+    // Lists the lines that contain text, in every file of the tree (those
+    // in lazy snapshot subtrees too, without materializing them), on
+    // scanThreads workers. Matches are passed to onMatch as they are found;
+    // with a limit the search stops after that many lines. Returns the
+    // number of matching lines.
+    size_t searchContents(const std::string& text, size_t limit,
+                          const std::function<void(const fs::path&, const ContentSearch::Hit&)>& onMatch) {
+        if (text.empty() || !root) return 0;
+
+        auto start = std::chrono::steady_clock::now();
+        ContentSearch search(collectFiles(), text, scanThreads);
+        size_t matches = 0;
+        std::vector<ContentSearch::Hit> hits;
+        while (matches < (limit ? limit : SIZE_MAX) && search.next(hits)) {
+            for (const ContentSearch::Hit& hit : hits) {
+                onMatch(search.file(hit.file), hit);
+                if (++matches == limit) break;
+            }
         }
+        search.cancel();
+
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        std::cout << "Searched " << search.filesSearched() << " files ("
+                  << Node::formatSize(search.bytesSearched()) << ", "
+                  << search.binaryFilesSkipped() << " binary skipped) in " << elapsed << "ms\n";
+        return matches;
+    }
 
-        if (!current) return;
+    // Lists the entries that satisfy a TreeQuery, in tree order, in one
+    // pass over the columnar view; records of lazy snapshot subtrees are
+    // tested in place and only the matches are materialized. With a limit
+    // the pass stops after that many matches. Like searchFiles, a repeated
+    // query, or one that adds terms to a cached one, is answered from the
+    // cache; queries on an age (mtime<30d) are not kept, as their answer
+    // changes by itself.
+    void queryTree(const std::string& expression, size_t limit = 0,
+                   const std::function<void(const Node*)>& onMatch = nullptr) {
+        searchResults.clear();
+        currentSearchTerm = expression;
+        if (!root) return;
 
         try {
-            std::regex re(pattern, std::regex_constants::icase);
-            if (std::regex_search(current->name, re)) {
-                searchResults.push_back(current);
+            auto query = std::make_shared<TreeQuery>(expression); // A bad query is reported before any walking
+            SearchCache::Entry* cached = nullptr;
+            if (!query->relativeToNow()) {
+                cached = &searchCache.lookup("query:" + expression);
+                if (cached->query) {
+                    query = cached->query;
+                } else {
+                    cached->query = query;
+                }
+                if (replayCached(*cached, limit, onMatch)) return;
             }
 
-            for (const auto& child : current->children) {
-                searchFiles(pattern, child.get());
+            const SearchCache::Entry* wider = searchCache.narrowest(contentGeneration,
+                [&](const SearchCache::Entry& entry) { return entry.query && query->narrows(*entry.query); });
+            if (wider) {
+                for (Node* node : wider->results) {
+                    SubtreeTotals below = subtreeTotals(node);
+                    TreeQuery::Entry entry{node->type == Node::DIRECTORY, below.bytes,
+                                           std::max(node->lastModified, below.newest), node->name(),
+                                           NamePool::Id(node->nameId), node->parent != nullptr};
+                    if (query->matches(entry, [&] { return node->path().string(); },
+                                       [&] { return relativePathOf(node); }) &&
+                        report(node, limit, onMatch)) {
+                        break;
+                    }
+                }
+            } else {
+                sweepQuery(*query, limit, onMatch);
+            }
+            if (cached) {
+                searchCache.store(*cached, searchResults, contentGeneration,
+                                  !limit || searchResults.size() < limit);
             }
+        } catch (const std::invalid_argument& e) {
+            std::cerr << "Invalid query: " << e.what() << "\n";
         } catch (const std::regex_error& e) {
-            std::cerr << "Invalid search pattern: " << e.what() << "\n";
+            std::cerr << "Invalid query: " << e.what() << "\n";
         }
     }
 
-    void displaySearchResults() const {
-        if (searchResults.empty()) {
-            std::cout << "No results found for: " << currentSearchTerm << "\n";
-            return;
+    // A fuzzy finder over every item below the root, including those still
+    // inside lazy snapshot subtrees (which are not materialized). It keeps
+    // its own copy of the names, so it stays usable while the tree changes;
+    // an entry is found again through findByRelativePath(relativePath).
+    FuzzyFinder fuzzyFinder() const {
+        FuzzyFinder finder(scanThreads);
+        if (!root) return finder;
+
+        const TreeColumns& view = columnView();
+        // The root itself is not an entry: paths are relative to it
+        std::vector<uint32_t> entryAtDepth{FuzzyFinder::noParent}; // the last entry seen at each depth
+        for (size_t row = 0; row < view.rows(); ++row) {
+            uint16_t depth = view.depth[row];
+            if (row > 0) {
+                entryAtDepth.resize(depth + 1);
+                entryAtDepth[depth] = finder.add(view.name(row), entryAtDepth[depth - 1]);
+            }
+            if (!(view.flags[row] & TreeColumns::LAZY_ROW) || !snapshot) continue;
+
+            uint32_t index = view.node[row]->snapshotIndex;
+            std::vector<std::pair<uint32_t, uint32_t>> ancestors{{index, entryAtDepth[depth]}};
+            for (uint32_t i = index + 1; i < snapshot->end(index); ++i) {
+                while (i >= snapshot->end(ancestors.back().first)) ancestors.pop_back();
+                uint32_t entry = finder.add(snapshot->name(i), ancestors.back().second);
+                if (snapshot->isDirectory(i)) ancestors.emplace_back(i, entry);
+            }
         }
+        finder.ownNames();
+        return finder;
+    }
 
-        std::cout << "Search results (" << searchResults.size() << ") for: "
-                  << currentSearchTerm << "\n";
-        for (const auto& result : searchResults) {
-            std::cout << "  " << (result->type == Node::DIRECTORY ? "📁 " : "📄 ")
-                      << result->name << "  " << result->fullPath << "\n";
+    // Paths of every file in the tree, including those still inside lazy
+    // snapshot subtrees (which are not materialized)
+    std::vector<fs::path> collectFiles() const {
+        std::vector<fs::path> files;
+        const TreeColumns& view = columnView();
+        for (size_t row = 0; row < view.rows(); ++row) {
+            if (!(view.flags[row] & TreeColumns::DIRECTORY_ROW)) {
+                files.push_back(view.node[row]->path());
+                continue;
+            }
+            if (!(view.flags[row] & TreeColumns::LAZY_ROW) || !snapshot) continue;
+
+            uint32_t index = view.node[row]->snapshotIndex;
+            std::vector<std::pair<uint32_t, fs::path>> ancestors{{index, view.node[row]->path()}};
+            for (uint32_t i = index + 1; i < snapshot->end(index); ++i) {
+                while (i >= snapshot->end(ancestors.back().first)) ancestors.pop_back();
+                fs::path path = ancestors.back().second / snapshot->name(i);
+                if (snapshot->isDirectory(i)) {
+                    ancestors.emplace_back(i, std::move(path));
+                } else {
+                    files.push_back(std::move(path));
+                }
+            }
         }
+        return files;
+    }
+
+    static void printSearchResult(const Node* result) {
+        std::cout << "  " << (result->type == Node::DIRECTORY ? "📁 " : "📄 ")
+                  << result->name() << "  " << result->path() << "\n";
     }
 
 private:
+    NameIndex names; // kept in step with every change to the tree
+    TrigramIndex trigrams; // only used with trigramSearch
+    SearchCache searchCache;
+    bool trigramsStarted = false;
+    mutable TreeColumns columns;
+    mutable uint64_t columnsGeneration = UINT64_MAX;
+
+    // The columnar view of the tree, rebuilt if the tree changed since
+    const TreeColumns& columnView() const {
+        if (columnsGeneration != generation) {
+            columns.build(root);
+            columnsGeneration = generation;
+        }
+        return columns;
+    }
+
+    // Adds a match to searchResults and passes it to onMatch; true once
+    // the limit is reached
+    bool report(Node* match, size_t limit, const std::function<void(const Node*)>& onMatch) {
+        if (!match) return false;
+        searchResults.push_back(match);
+        if (onMatch) onMatch(match);
+        return limit && searchResults.size() >= limit;
+    }
+
+    // Reports the cached results of an entry that can answer this search;
+    // false if it cannot
+    bool replayCached(const SearchCache::Entry& cached, size_t limit,
+                      const std::function<void(const Node*)>& onMatch) {
+        if (!cached.answers(contentGeneration, limit)) return false;
+        for (Node* node : cached.results) {
+            if (report(node, limit, onMatch)) break;
+        }
+        return true;
+    }
+
+    // The sweep of searchFiles, through the trigram index if it can help
+    void sweepNames(SearchPattern& matcher, size_t limit, const std::function<void(const Node*)>& onMatch) {
+        if (trigramSearch && !matcher.matchesPaths()) {
+            std::vector<uint32_t> required = TrigramIndex::trigramsOf(matcher.requiredLiterals());
+            if (!required.empty()) {
+                searchIndexed(matcher, required, limit, onMatch);
+                return;
+            }
+        }
+
+        // Materializing snapshot hits only adds nodes below lazy rows, so
+        // the view stays usable while the workers sweep it
+        const TreeColumns& view = columnView();
+        ParallelSearch search(view, snapshot.get(), matcher, scanThreads);
+        std::vector<ParallelSearch::Hit> hits;
+        while (search.next(hits)) {
+            for (const ParallelSearch::Hit& hit : hits) {
+                Node* match = hit.record == MappedSnapshot::npos ? view.node[hit.row]
+                                                                 : materializeRecord(hit.record);
+                if (report(match, limit, onMatch)) return; // Cancels the rest
+            }
+        }
+    }
+
+    // The single pass of queryTree
+    void sweepQuery(TreeQuery& query, size_t limit, const std::function<void(const Node*)>& onMatch) {
+        bool needsPath = query.needsPath();
+        bool needsTotals = query.needsTotals(); // Summing a directory record's subtree is not free
+        const TreeColumns& view = columnView();
+        // Once a snapshot record matched, later matches wait for it to be
+        // materialized after the pass, so the results stay in tree order
+        std::vector<std::pair<Node*, uint32_t>> pending;
+        for (size_t row = 0; row < view.rows(); ++row) {
+            bool directory = view.flags[row] & TreeColumns::DIRECTORY_ROW;
+            TreeQuery::Entry entry{directory, view.size[row], view.lastModified[row],
+                                   view.name(row), view.nameId[row], row != 0};
+            if (query.matches(entry, [&] { return view.node[row]->path().string(); },
+                              [&] { return relativePathOf(view.node[row]); })) {
+                if (!pending.empty()) {
+                    pending.emplace_back(view.node[row], MappedSnapshot::npos);
+                } else if (report(view.node[row], limit, onMatch)) {
+                    return;
+                }
+            }
+            if (!(view.flags[row] & TreeColumns::LAZY_ROW) || !snapshot) continue;
+
+            // Paths are only built if the query has a path term
+            uint32_t index = view.node[row]->snapshotIndex;
+            std::vector<std::pair<uint32_t, std::string>> ancestors;
+            if (needsPath) ancestors.emplace_back(index, view.node[row]->path().string());
+            for (uint32_t i = index + 1; i < snapshot->end(index); ++i) {
+                const SnapshotRecord& record = snapshot->record(i);
+                bool recordIsDirectory = snapshot->isDirectory(i);
+                std::string_view name = snapshot->name(i);
+                std::string path;
+                if (needsPath) {
+                    while (i >= snapshot->end(ancestors.back().first)) ancestors.pop_back();
+                    path = (fs::path(ancestors.back().second) / name).string();
+                }
+                SubtreeTotals below = recordIsDirectory && needsTotals ? snapshot->totals(i) : SubtreeTotals{};
+                TreeQuery::Entry recordEntry{recordIsDirectory, recordIsDirectory ? below.bytes : record.size,
+                                             std::max(record.lastModified, below.newest), name, 0, false};
+                if (query.matches(recordEntry, [&]() -> const std::string& { return path; },
+                                  [&] { return fs::path(path).lexically_relative(root->path()).generic_string(); })) {
+                    pending.emplace_back(nullptr, i);
+                }
+                if (needsPath && recordIsDirectory) ancestors.emplace_back(i, std::move(path));
+            }
+        }
+
+        for (auto [node, record] : pending) {
+            if (report(node ? node : materializeRecord(record), limit, onMatch)) return;
+        }
+    }
+
+    // Answers a search from the trigram index: only the names, and the
+    // records of lazy snapshot subtrees, that contain every required
+    // trigram are matched, so the cost follows the number of candidates
+    // rather than the size of the tree
+    void searchIndexed(SearchPattern& matcher, const std::vector<uint32_t>& required, size_t limit,
+                       const std::function<void(const Node*)>& onMatch) {
+        if (matcher.matches(root->name()) && report(root, limit, onMatch)) return;
+
+        // Index the names that appeared since the last search
+        if (!trigramsStarted) {
+            names.trackNewNames();
+            names.forEachName([this](NamePool::Id id) { trigrams.addName(id); });
+            trigramsStarted = true;
+        }
+        for (NamePool::Id id : names.takeNewNames()) {
+            trigrams.addName(id);
+        }
+
+        for (NamePool::Id id : trigrams.candidateNames(required)) {
+            if (!matcher.matches(id)) continue;
+            for (Node* node : names.find(id)) {
+                if (report(node, limit, onMatch)) return;
+            }
+        }
+
+        if (!snapshot || names.lazy().empty()) return;
+        // Only records below a lazy directory still stand for the disk
+        std::vector<std::pair<uint32_t, uint32_t>> lazyRanges;
+        for (const Node* dir : names.lazy()) {
+            lazyRanges.emplace_back(dir->snapshotIndex, snapshot->end(dir->snapshotIndex));
+        }
+        std::sort(lazyRanges.begin(), lazyRanges.end());
+
+        std::vector<uint32_t> hits;
+        for (uint32_t record : trigrams.candidateRecords(*snapshot, required)) {
+            auto it = std::upper_bound(lazyRanges.begin(), lazyRanges.end(),
+                                       std::make_pair(record, UINT32_MAX));
+            if (it == lazyRanges.begin() || record >= std::prev(it)->second ||
+                record == std::prev(it)->first) {
+                continue;
+            }
+            if (matcher.matches(snapshot->name(record))) hits.push_back(record);
+        }
+        for (uint32_t hit : hits) {
+            if (report(materializeRecord(hit), limit, onMatch)) return;
+        }
+    }
+
+    // True if node is ancestor or lies below it
+    static bool isWithin(const Node* node, const Node* ancestor) {
+        for (; node; node = node->parent) {
+            if (node == ancestor) return true;
+        }
+        return false;
+    }
+
+    // Direct child of dir with the given name, or nullptr (dir must be loaded)
+    Node* findChild(const Node* dir, std::string_view name) const {
+        NamePool::Id id;
+        if (!NamePool::instance().lookup(name, id)) return nullptr;
+        return names.child(dir, id);
+    }
+
+    // Returns the Node for a snapshot record, materializing the directories
+    // on the way down from the root (but nothing else)
+    Node* materializeRecord(uint32_t index) {
+        Node* node = root;
+        while (node && node->snapshotIndex != index) {
+            ensureLoaded(node);
+            Node* next = nullptr;
+            for (Node* child : node->children) {
+                uint32_t childIndex = child->snapshotIndex;
+                if (childIndex != Node::noSnapshot && childIndex <= index &&
+                    index < snapshot->end(childIndex)) {
+                    next = child;
+                    break;
+                }
+            }
+            node = next;
+        }
+        return node;
+    }
+
+#ifdef _WIN32
+    void materializeAll(Node* node) {
+        ensureLoaded(node);
+        for (Node* child : node->children) {
+            materializeAll(child);
+        }
+    }
+#endif
+
+    // Re-lists one directory and merges the listing into its existing
+    // children: entries that are still there keep their Node (files get
+    // fresh metadata), vanished ones are removed and new ones are added, new
+    // directories with their whole subtree. Kept directories are returned so
+    // the caller can refresh them in turn.
+    void reconcileDirectory(Node* dir, RefreshStats& stats, std::vector<Node*>& keptDirectories) {
+        ensureLoaded(dir);
+        ++stats.directoriesRescanned;
+        SubtreeTotals before = dir->children.totals();
+
+        // The listing lives in the lister's arena; only new entries are
+        // copied into the tree
+        Node listing(*dir);
+        listing.children = ChildList();
+        std::vector<Node*> listedSubdirs;
+        ParallelScanner lister(1, false);
+        lister.listChildren(&listing, listedSubdirs);
+        std::sort(listedSubdirs.begin(), listedSubdirs.end());
+
+        std::unordered_map<NamePool::Id, Node*> previousByName;
+        for (Node* child : dir->children) {
+            previousByName.emplace(NamePool::Id(child->nameId), child);
+        }
+
+        std::vector<Node*> merged;
+        merged.reserve(listing.children.size());
+        for (Node* fresh : listing.children) {
+            auto it = previousByName.find(fresh->nameId);
+            if (it != previousByName.end() && it->second->type == fresh->type) {
+                Node* existing = it->second;
+                if (existing->type == Node::FILE) {
+                    existing->setInfo(fresh->info());
+                } else {
+                    keptDirectories.push_back(existing);
+                }
+                merged.push_back(existing);
+                previousByName.erase(it);
+                continue;
+            }
+
+            Node* added = nullptr;
+            if (std::binary_search(listedSubdirs.begin(), listedSubdirs.end(), fresh)) {
+                added = buildTree(fresh->path(), arena, false, dir);
+                if (added) stats.addedDirectories.push_back(added);
+            }
+            if (!added) added = arena.makeChild(dir, fresh->nameId, fresh->type, fresh->info());
+            names.addSubtree(added);
+            merged.push_back(added);
+        }
+
+        for (const auto& [nameId, gone] : previousByName) {
+            forgetSearchResults(gone);
+            names.removeSubtree(gone);
+            arena.release(gone);
+        }
+        dir->children.assign(arena, merged);
+        dir->lazy = false;
+
+        // Kept directories still have their old totals; refreshing them
+        // later corrects this one again
+        SubtreeTotals after = sumChildren(dir);
+        dir->children.setTotals(arena, after);
+        adjustTotals(dir->parent, after, before);
+    }
+
+    // Adds a new node (or subtree) to the tree under parent
+    void insertChild(Node* parent, Node* child) {
+        placeChild(parent, child);
+        adjustTotals(parent, subtreeTotals(child), {});
+        names.addSubtree(child);
+        markChanged();
+    }
+
+    // Keeps children in name order, as the scanner produces them, so that
+    // the display order is stable whatever the order of edits
+    void placeChild(Node* parent, Node* child) {
+        auto it = std::lower_bound(parent->children.begin(), parent->children.end(), child,
+                                   Node::byName);
+        parent->children.insert(arena, it, child);
+    }
+
+    void detachChild(Node* parent, Node* child) {
+        forgetSearchResults(child);
+        names.removeSubtree(child);
+        SubtreeTotals removed = subtreeTotals(child);
+        auto& children = parent->children;
+        children.erase(std::remove(children.begin(), children.end(), child), children.end());
+        adjustTotals(parent, {}, removed);
+        arena.release(child);
+        markChanged();
+    }
+
+    static SubtreeTotals sumChildren(const Node* dir) {
+        SubtreeTotals sum;
+        for (const Node* child : dir->children) {
+            if (child->type == Node::DIRECTORY) {
+                sum.add(child->children.totals());
+            } else {
+                sum.add({child->size(), 1, child->lastModified});
+            }
+        }
+        return sum;
+    }
+
+    // Lazy directories below already have their totals (see ensureLoaded)
+    static void sumSubtree(Node* dir, NodeArena& arena) {
+        for (Node* child : dir->children) {
+            if (child->type == Node::DIRECTORY && !child->lazy) sumSubtree(child, arena);
+        }
+        dir->children.setTotals(arena, sumChildren(dir));
+    }
+
+    Node* scanTree(const fs::path& currentPath, NodeArena& into, bool showProgress, Node* parent) {
+        if (!fs::exists(currentPath)) {
+            std::cerr << "Error: Path does not exist: " << currentPath << "\n";
+            return nullptr;
+        }
+
+        try {
+            if (scanBackend == IO_URING) {
+#ifdef FSM_HAVE_IO_URING
+                if (UringScanner::available()) {
+                    try {
+                        UringScanner scanner(showProgress);
+                        return scanner.scan(currentPath, into, parent);
+                    } catch (const std::exception& e) {
+                        std::cerr << "io_uring scan failed (" << e.what() << ").\n";
+                    }
+                }
+#endif
+                std::cerr << "io_uring is not available, using the thread pool scanner.\n";
+                scanBackend = THREAD_POOL;
+            }
+
+            ParallelScanner scanner(scanThreads, showProgress);
+            return scanner.scan(currentPath, into, parent);
+        } catch (...) {
+            std::cerr << "Error building tree for: " << currentPath << "\n";
+            return nullptr;
+        }
+    }
+
+    // Records a change to the items of the tree
+    void markChanged() {
+        ++generation;
+        ++contentGeneration;
+    }
+
+    // Applies a change below dir to the totals of dir and of every
+    // directory above it: `added` came in and `removed` went away. Only the
+    // newest time takes more than arithmetic, when what went was the newest.
+    void adjustTotals(Node* dir, const SubtreeTotals& added, const SubtreeTotals& removed) {
+        for (; dir; dir = dir->parent) {
+            SubtreeTotals totals = dir->children.totals();
+            totals.bytes += added.bytes - removed.bytes;
+            totals.files += added.files - removed.files;
+            if (removed.files && removed.newest >= totals.newest) {
+                totals.newest = sumChildren(dir).newest;
+            } else {
+                totals.newest = std::max(totals.newest, added.newest);
+            }
+            dir->children.setTotals(arena, totals);
+        }
+    }
+
+    // Re-reads a file's size and time (or sets them to info), keeping the
+    // totals above it in step
+    void updateFileInfo(Node* file, const FileStat* info = nullptr) {
+        SubtreeTotals before = subtreeTotals(file);
+        if (info) {
+            file->setInfo(*info);
+        } else {
+            file->updateFileInfo();
+        }
+        adjustTotals(file->parent, subtreeTotals(file), before);
+    }
+
+    // Drops search results that point into a subtree about to be destroyed
+    // (and all cached ones, which are stale by then anyway)
+    void forgetSearchResults(const Node* subtree) {
+        searchCache.forgetResults();
+        if (searchResults.empty()) return;
+        std::vector<const Node*> stack{subtree};
+        std::vector<const Node*> doomed;
+        while (!stack.empty()) {
+            const Node* node = stack.back();
+            stack.pop_back();
+            doomed.push_back(node);
+            stack.insert(stack.end(), node->children.begin(), node->children.end());
+        }
+        std::sort(doomed.begin(), doomed.end());
+        searchResults.erase(std::remove_if(searchResults.begin(), searchResults.end(),
+            [&](Node* result) { return std::binary_search(doomed.begin(), doomed.end(), result); }),
+            searchResults.end());
+    }
+
+    // Stats every directory of a snapshot subtree, without materializing
+    // anything, and collects the pre-order indices of those to rescan. One
+    // that vanished marks its parent instead. Symlinked directories are never
+    // descended into. Returns false if the subtree's root itself is gone.
+    bool findChangedDirectories(uint32_t start, const fs::path& startPath,
+                                std::vector<uint32_t>& changed, size_t& checked) const {
+        const MappedSnapshot& view = *snapshot;
+        std::vector<std::pair<uint32_t, fs::path>> ancestors{{start, startPath}};
+
+        for (uint32_t i = start + 1; i < view.end(start);) {
+            while (ancestors.size() > 1 && i >= view.end(ancestors.back().first)) {
+                ancestors.pop_back();
+            }
+            if (!view.isDirectory(i)) {
+                ++i;
+                continue;
+            }
+
+            fs::path path = ancestors.back().second / view.name(i);
+            FileStat info = statNoFollow(path);
+            ++checked;
+            if (!info.exists || (!info.isSymlink && !info.isDirectory)) {
+                uint32_t parent = ancestors.back().first;
+                if (parent == start) return false; // Caller rescans the whole subtree
+                while (!changed.empty() && changed.back() > parent) changed.pop_back();
+                changed.push_back(parent);
+                ancestors.pop_back();
+                i = view.end(parent);
+            } else if (info.isSymlink) {
+                i = view.end(i);
+            } else if (info.lastModified != view.record(i).lastModified ||
+                       (info.inode && view.record(i).inode && info.inode != view.record(i).inode)) {
+                changed.push_back(i);
+                i = view.end(i);
+            } else {
+                ancestors.emplace_back(i, std::move(path));
+                ++i;
+            }
+        }
+        return true;
+    }
+
     void displayFileContent(const fs::path& filePath) {
         try {
             std::ifstream file(filePath);
@@ -489,6 +4704,329 @@ private:
     }
 };
 
+// ==================== Live Watcher ====================
+// Keeps the in-memory tree in step with the disk from a background thread.
+// Linux only: with CAP_SYS_ADMIN a single fanotify mark covers the whole
+// file system the root lives on; otherwise (and for directories mounted from
+// other file systems) every directory gets an inotify watch. Events are
+// coalesced by path and applied in batches under FileSystemTree::mutex:
+// each changed path is simply re-stat'ed and synced, so it does not matter
+// how many events (or which ones) led to it. When events were lost (queue
+// overflow) or a directory could not be watched (watch limit), the affected
+// directories are re-checked by mtime and only changed ones are re-listed.
+class TreeWatcher {
+public:
+    explicit TreeWatcher(FileSystemTree& tree) : tree(tree) {}
+    TreeWatcher(const TreeWatcher&) = delete;
+    TreeWatcher& operator=(const TreeWatcher&) = delete;
+
+    ~TreeWatcher() {
+        stop();
+    }
+
+    // Returns false if live watching is not supported here
+    bool start() {
+#ifdef FSM_HAVE_INOTIFY
+        std::vector<fs::path> directories;
+        {
+            std::lock_guard<std::mutex> lock(tree.mutex);
+            if (!tree.root || tree.root->type != Node::DIRECTORY) return false;
+            rootPath = tree.root->path();
+            tree.collectDirectories(tree.root, directories);
+        }
+
+        inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotifyFd < 0) return false;
+        openFanotify();
+
+        running = true;
+        thread = std::thread([this, directories = std::move(directories)]() {
+            for (const auto& dir : directories) addWatch(dir);
+            run();
+        });
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    void stop() {
+        running = false;
+        if (thread.joinable()) thread.join();
+#ifdef FSM_HAVE_INOTIFY
+        if (inotifyFd >= 0) ::close(inotifyFd);
+        if (fanotifyFd >= 0) ::close(fanotifyFd);
+        if (mountFd >= 0) ::close(mountFd);
+        inotifyFd = fanotifyFd = mountFd = -1;
+#endif
+    }
+
+private:
+    FileSystemTree& tree;
+    std::thread thread;
+    std::atomic<bool> running{false};
+
+#ifdef FSM_HAVE_INOTIFY
+    static constexpr uint32_t watchMask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                                          IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB;
+    static constexpr auto settleTime = std::chrono::milliseconds(50);
+    static constexpr auto unwatchedInterval = std::chrono::seconds(5);
+    static constexpr size_t maxPending = 4096;
+
+    int inotifyFd = -1;
+    int fanotifyFd = -1;
+    int mountFd = -1;      // any fd on the marked file system, for open_by_handle_at
+    dev_t rootDevice = 0;
+    fs::path rootPath;
+    std::unordered_map<int, fs::path> watchPaths; // inotify wd -> directory
+    std::map<fs::path, int> watchByPath;          // ordered, so a subtree is a range
+    std::set<fs::path> unwatched;                 // over the watch limit; polled by mtime
+    std::map<fs::path, uint32_t> pending;         // changed entry -> accumulated event mask
+    bool overflowed = false;
+    bool limitReported = false;
+    std::chrono::steady_clock::time_point lastEvent, lastUnwatchedCheck;
+
+    static bool isUnder(const fs::path& path, const fs::path& prefix) {
+        return std::mismatch(prefix.begin(), prefix.end(), path.begin(), path.end()).first == prefix.end();
+    }
+
+    void openFanotify() {
+#ifdef FSM_HAVE_FANOTIFY
+        struct stat st;
+        if (::stat(rootPath.c_str(), &st) != 0) return;
+        rootDevice = st.st_dev;
+
+        fanotifyFd = fanotify_init(FAN_CLASS_NOTIF | FAN_REPORT_DFID_NAME | FAN_NONBLOCK | FAN_CLOEXEC,
+                                   O_RDONLY | O_CLOEXEC);
+        if (fanotifyFd < 0) return; // Needs CAP_SYS_ADMIN
+        uint64_t mask = FAN_CREATE | FAN_DELETE | FAN_MOVED_FROM | FAN_MOVED_TO |
+                        FAN_MODIFY | FAN_CLOSE_WRITE | FAN_ATTRIB | FAN_ONDIR;
+        mountFd = ::open(rootPath.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (mountFd < 0 ||
+            fanotify_mark(fanotifyFd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, mask, AT_FDCWD, rootPath.c_str()) != 0) {
+            if (mountFd >= 0) ::close(mountFd);
+            ::close(fanotifyFd);
+            fanotifyFd = mountFd = -1;
+        }
+#endif
+    }
+
+    void addWatch(const fs::path& dir) {
+        if (fanotifyFd >= 0) {
+            struct stat st;
+            if (::lstat(dir.c_str(), &st) != 0 || st.st_dev == rootDevice) return; // fanotify sees it
+        }
+
+        // IN_DONT_FOLLOW | IN_ONLYDIR skips symlinked directories, like the scanner
+        int wd = inotify_add_watch(inotifyFd, dir.c_str(), watchMask | IN_ONLYDIR | IN_DONT_FOLLOW);
+        if (wd >= 0) {
+            watchPaths[wd] = dir;
+            watchByPath[dir] = wd;
+            unwatched.erase(dir);
+        } else if (errno == ENOSPC) {
+            if (!limitReported) {
+                std::cerr << "inotify watch limit reached; some folders will be re-checked every "
+                          << unwatchedInterval.count() << "s instead.\n";
+                limitReported = true;
+            }
+            unwatched.insert(dir);
+        }
+    }
+
+    void watchSubtree(const Node* dir) {
+        std::vector<fs::path> directories;
+        tree.collectDirectories(dir, directories);
+        for (const auto& path : directories) addWatch(path);
+    }
+
+    // Forgets the watches of a directory that was deleted or moved away
+    void dropWatchesUnder(const fs::path& dir) {
+        for (auto it = watchByPath.lower_bound(dir); it != watchByPath.end() && isUnder(it->first, dir);) {
+            inotify_rm_watch(inotifyFd, it->second);
+            watchPaths.erase(it->second);
+            it = watchByPath.erase(it);
+        }
+        for (auto it = unwatched.lower_bound(dir); it != unwatched.end() && isUnder(*it, dir);) {
+            it = unwatched.erase(it);
+        }
+    }
+
+    void run() {
+        lastUnwatchedCheck = std::chrono::steady_clock::now();
+        while (running) {
+            pollfd fds[2] = {{inotifyFd, POLLIN, 0}, {fanotifyFd, POLLIN, 0}};
+            ::poll(fds, fanotifyFd >= 0 ? 2 : 1, 100);
+
+            readInotify();
+            readFanotify();
+
+            auto now = std::chrono::steady_clock::now();
+            if ((!pending.empty() || overflowed) &&
+                (now - lastEvent >= settleTime || pending.size() >= maxPending)) {
+                applyPending();
+            }
+            if (!unwatched.empty() && now - lastUnwatchedCheck >= unwatchedInterval) {
+                checkUnwatched();
+                lastUnwatchedCheck = now;
+            }
+        }
+    }
+
+    void readInotify() {
+        alignas(struct inotify_event) char buffer[64 * 1024];
+        while (true) {
+            ssize_t bytes = ::read(inotifyFd, buffer, sizeof(buffer));
+            if (bytes <= 0) return;
+            lastEvent = std::chrono::steady_clock::now();
+
+            // Headers are copied out rather than read in place, since only
+            // the first event is sure to be aligned
+            for (size_t offset = 0; offset + sizeof(struct inotify_event) <= static_cast<size_t>(bytes);) {
+                struct inotify_event event;
+                std::memcpy(&event, buffer + offset, sizeof(event));
+                const char* name = buffer + offset + sizeof(event);
+                offset += sizeof(event) + event.len;
+                if (offset > static_cast<size_t>(bytes)) break;
+
+                if (event.mask & IN_Q_OVERFLOW) {
+                    overflowed = true;
+                } else if (event.mask & IN_IGNORED) {
+                    // Watch removed by the kernel (directory deleted)
+                    auto it = watchPaths.find(event.wd);
+                    if (it != watchPaths.end()) {
+                        watchByPath.erase(it->second);
+                        watchPaths.erase(it);
+                    }
+                } else if (event.len > 0) {
+                    auto it = watchPaths.find(event.wd);
+                    if (it != watchPaths.end()) pending[it->second / std::string(name, strnlen(name, event.len))] |= event.mask;
+                }
+            }
+        }
+    }
+
+    void readFanotify() {
+#ifdef FSM_HAVE_FANOTIFY
+        if (fanotifyFd < 0) return;
+        alignas(struct fanotify_event_metadata) char buffer[64 * 1024];
+        while (true) {
+            ssize_t bytes = ::read(fanotifyFd, buffer, sizeof(buffer));
+            if (bytes <= 0) return;
+            lastEvent = std::chrono::steady_clock::now();
+
+            // The kernel pads events and their info records to 4 bytes, so
+            // all but the first may be misaligned: headers are copied out
+            for (size_t offset = 0; offset + FAN_EVENT_METADATA_LEN <= static_cast<size_t>(bytes);) {
+                struct fanotify_event_metadata event;
+                std::memcpy(&event, buffer + offset, sizeof(event));
+                if (event.event_len < FAN_EVENT_METADATA_LEN || offset + event.event_len > static_cast<size_t>(bytes)) break;
+                const char* info = buffer + offset + event.metadata_len;
+                const char* end = buffer + offset + event.event_len;
+                offset += event.event_len;
+
+                if (event.fd >= 0) ::close(event.fd);
+                if (event.mask & FAN_Q_OVERFLOW) {
+                    overflowed = true;
+                    continue;
+                }
+                while (info + sizeof(struct fanotify_event_info_header) <= end) {
+                    struct fanotify_event_info_header header;
+                    std::memcpy(&header, info, sizeof(header));
+                    if (header.len == 0 || header.len > end - info) break;
+                    if (header.info_type == FAN_EVENT_INFO_TYPE_DFID_NAME) {
+                        queueFanotifyEntry(info, header.len, static_cast<uint32_t>(event.mask));
+                    }
+                    info += header.len;
+                }
+            }
+        }
+#endif
+    }
+
+#ifdef FSM_HAVE_FANOTIFY
+    // The record holds the parent directory's file handle followed by the
+    // entry name; turn the handle back into a path via /proc/self/fd. The
+    // handle is copied to aligned storage before it is passed on.
+    void queueFanotifyEntry(const char* record, size_t recordLength, uint32_t mask) {
+        const size_t handleOffset = offsetof(struct fanotify_event_info_fid, handle);
+        struct file_handle handleHeader;
+        if (recordLength < handleOffset + sizeof(handleHeader)) return;
+        std::memcpy(&handleHeader, record + handleOffset, sizeof(handleHeader));
+        size_t handleSize = sizeof(handleHeader) + handleHeader.handle_bytes;
+        if (handleHeader.handle_bytes > MAX_HANDLE_SZ || handleOffset + handleSize >= recordLength) return;
+
+        alignas(struct file_handle) char handleBuffer[sizeof(struct file_handle) + MAX_HANDLE_SZ];
+        std::memcpy(handleBuffer, record + handleOffset, handleSize);
+        auto* handle = reinterpret_cast<struct file_handle*>(handleBuffer);
+        const char* nameStart = record + handleOffset + handleSize;
+        std::string name(nameStart, strnlen(nameStart, recordLength - handleOffset - handleSize));
+
+        int dirFd = open_by_handle_at(mountFd, handle, O_PATH | O_CLOEXEC);
+        if (dirFd < 0) return; // Directory already gone; its parent reports that
+        char target[4096];
+        std::string link = "/proc/self/fd/" + std::to_string(dirFd);
+        ssize_t length = ::readlink(link.c_str(), target, sizeof(target));
+        ::close(dirFd);
+        if (length <= 0 || static_cast<size_t>(length) >= sizeof(target)) return;
+
+        fs::path dir(std::string(target, static_cast<size_t>(length)));
+        if (!isUnder(dir, rootPath)) return; // Elsewhere on the same file system
+        if (name != ".") pending[dir / name] |= mask;
+    }
+#endif
+
+    void applyPending() {
+        std::lock_guard<std::mutex> lock(tree.mutex);
+        if (!tree.root) {
+            pending.clear();
+            return;
+        }
+
+        if (overflowed) {
+            // Events were lost; find out where by comparing directory mtimes
+            overflowed = false;
+            FileSystemTree::RefreshStats stats;
+            tree.refresh(stats);
+            for (const Node* dir : stats.addedDirectories) watchSubtree(dir);
+        }
+
+        // Deletions and moves first, so a directory moved within the tree
+        // gets its new watches after the old ones are gone (the event bits
+        // are the same for inotify and fanotify)
+        for (const auto& [path, mask] : pending) {
+            if (mask & (IN_DELETE | IN_MOVED_FROM)) dropWatchesUnder(path);
+        }
+        // Parents sort before their children, so new directories exist in the
+        // tree before entries inside them are synced
+        for (const auto& [path, mask] : pending) {
+            if (const Node* added = tree.syncEntry(path)) watchSubtree(added);
+        }
+        pending.clear();
+    }
+
+    void checkUnwatched() {
+        std::lock_guard<std::mutex> lock(tree.mutex);
+        std::vector<fs::path> directories(unwatched.begin(), unwatched.end());
+        const fs::path* lastChecked = nullptr;
+        for (const auto& dir : directories) {
+            // refreshSubtree covers subdirectories, so skip nested entries
+            if (lastChecked && isUnder(dir, *lastChecked)) continue;
+            lastChecked = &dir;
+
+            FileSystemTree::RefreshStats stats;
+            Node* node = tree.resolvePath(dir);
+            if (!node || !tree.refreshSubtree(node, stats)) {
+                dropWatchesUnder(dir); // Gone; its parent's sync removes the node
+                continue;
+            }
+            unwatched.erase(dir);
+            addWatch(dir); // Retry in case watches were freed up
+            for (const Node* added : stats.addedDirectories) watchSubtree(added);
+        }
+    }
+#endif
+};
+
 // ==================== Enhanced User Interface ====================
 void clearScreen() {
 #ifdef _WIN32
@@ -521,24 +5059,641 @@ void pressEnterToContinue() {
     std::cin.get(); // Wait for user to press Enter
 }
 
-int main() {
+// Reads key presses one at a time, without echo and without waiting for
+// Enter, for as long as it lives (stdin must be a terminal)
+class RawKeyboard {
+public:
+    enum Key { END = -1, UP = -2, DOWN = -3 };
+
+#ifdef _WIN32
+    int read() {
+        int c = _getch();
+        if (c == 0 || c == 224) { // Arrow and function keys come as two codes
+            int code = _getch();
+            return code == 72 ? UP : code == 80 ? DOWN : read();
+        }
+        return c;
+    }
+#else
+    RawKeyboard() {
+        tcgetattr(STDIN_FILENO, &saved);
+        raw = saved;
+        raw.c_lflag &= ~(ICANON | ECHO | ISIG);
+        raw.c_cc[VMIN] = 1;
+        raw.c_cc[VTIME] = 0;
+        tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
+    }
+    ~RawKeyboard() { tcsetattr(STDIN_FILENO, TCSAFLUSH, &saved); }
+    RawKeyboard(const RawKeyboard&) = delete;
+    RawKeyboard& operator=(const RawKeyboard&) = delete;
+
+    int read() {
+        unsigned char c;
+        if (::read(STDIN_FILENO, &c, 1) != 1) return END;
+        if (c != 27) return c;
+
+        // Arrow keys arrive as ESC [ A/B; a lone Esc is followed by nothing
+        termios waiting = raw;
+        waiting.c_cc[VMIN] = 0;
+        waiting.c_cc[VTIME] = 1; // tenths of a second
+        tcsetattr(STDIN_FILENO, TCSANOW, &waiting);
+        unsigned char sequence[2];
+        size_t got = 0;
+        while (got < 2 && ::read(STDIN_FILENO, sequence + got, 1) == 1) ++got;
+        tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+        if (got == 2 && sequence[0] == '[' && (sequence[1] == 'A' || sequence[1] == 'B')) {
+            return sequence[1] == 'A' ? UP : DOWN;
+        }
+        return 27;
+    }
+
+private:
+    termios saved{}, raw{};
+#endif
+};
+
+bool stdinIsTerminal() {
+#ifdef _WIN32
+    return _isatty(_fileno(stdin));
+#else
+    return isatty(STDIN_FILENO);
+#endif
+}
+
+// Picks an item by typing part of its name (or of its path, once the query
+// has a '/'): the best fuzzy matches are listed again after every key, Up
+// and Down (or Ctrl-P and Ctrl-N) move, Enter picks and Esc cancels. When
+// stdin is not a terminal, the matches of query are listed once and a
+// number is asked for. Returns the path of the item relative to the root,
+// or an empty string; the tree is only locked while the finder is built.
+std::string fuzzyChoose(FileSystemTree& fileTree, std::string query) {
+    const size_t shown = 15;
+    FuzzyFinder finder = [&] {
+        std::lock_guard<std::mutex> lock(fileTree.mutex);
+        return fileTree.fuzzyFinder();
+    }();
+    std::vector<FuzzyFinder::Match> best;
+
+    if (!stdinIsTerminal()) {
+        finder.search(query, shown, best);
+        if (best.empty()) return {};
+        for (size_t i = 0; i < best.size(); ++i) {
+            std::cout << "  " << i + 1 << ". " << finder.relativePath(best[i].entry) << "\n";
+        }
+        std::cout << "Which one (1-" << best.size() << ")? ";
+        std::string answer;
+        std::getline(std::cin, answer);
+        try {
+            size_t pick = std::stoul(answer);
+            if (pick >= 1 && pick <= best.size()) return finder.relativePath(best[pick - 1].entry);
+        } catch (const std::exception&) {
+        }
+        return {};
+    }
+
+    RawKeyboard keyboard;
+    size_t selected = 0;
+    while (true) {
+        auto start = std::chrono::steady_clock::now();
+        size_t total = finder.search(query, shown, best);
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        if (selected >= best.size()) selected = best.empty() ? 0 : best.size() - 1;
+
+#ifdef _WIN32
+        clearScreen();
+#else
+        std::cout << "\033[H\033[2J"; // cheaper than running clear on every key
+#endif
+        std::cout << "Find (Up/Down to move, Enter to pick, Esc to cancel)\n";
+        for (size_t i = 0; i < best.size(); ++i) {
+            std::cout << (i == selected ? "> " : "  ") << finder.relativePath(best[i].entry) << "\n";
+        }
+        std::cout << total << "/" << finder.size() << " (" << std::fixed << std::setprecision(1)
+                  << elapsed.count() << "ms)\n> " << query << std::flush;
+
+        int key = keyboard.read();
+        if (key == '\r' || key == '\n') {
+            std::cout << "\n";
+            return best.empty() ? std::string() : finder.relativePath(best[selected].entry);
+        } else if (key == 27 || key == 3 || key == RawKeyboard::END) { // Esc, Ctrl-C
+            std::cout << "\n";
+            return {};
+        } else if (key == RawKeyboard::UP || key == 16) { // Ctrl-P
+            if (selected > 0) --selected;
+        } else if (key == RawKeyboard::DOWN || key == 14) { // Ctrl-N
+            if (selected + 1 < best.size()) ++selected;
+        } else if (key == 127 || key == 8) { // Backspace
+            if (!query.empty()) query.pop_back();
+            selected = 0;
+        } else if (key >= 32 && key != 127) {
+            query += static_cast<char>(key);
+            selected = 0;
+        }
+    }
+}
+
+// Looks up an item by relative path or by name; when several items share
+// the name, lists their paths and asks which one is meant. A name starting
+// with '?' opens the fuzzy finder on the rest instead. Returns the item's
+// path relative to the root, or an empty string if there is no such item
+// or the answer is not one of the listed numbers. The tree is not locked
+// while waiting for an answer, so callers look the path up again, under
+// the lock, right before they use the item.
+std::string chooseNode(FileSystemTree& fileTree, const std::string& name) {
+    if (!name.empty() && name[0] == '?') return fuzzyChoose(fileTree, name.substr(1));
+    if (fs::path(name).has_parent_path()) return name;
+
+    std::vector<std::string> matches;
+    {
+        std::lock_guard<std::mutex> lock(fileTree.mutex);
+        for (const Node* node : fileTree.findNodes(name)) {
+            matches.push_back(node == fileTree.root ? "." : fileTree.relativePathOf(node));
+        }
+    }
+    if (matches.size() <= 1) return matches.empty() ? std::string() : matches.front();
+
+    std::cout << "Several items are named '" << name << "':\n";
+    for (size_t i = 0; i < matches.size(); ++i) {
+        std::cout << "  " << i + 1 << ". " << matches[i] << "\n";
+    }
+    std::cout << "Which one (1-" << matches.size() << ")? ";
+    std::string answer;
+    std::getline(std::cin, answer);
+    try {
+        size_t pick = std::stoul(answer);
+        if (pick >= 1 && pick <= matches.size()) return matches[pick - 1];
+    } catch (const std::exception&) {
+    }
+    return {};
+}
+
+size_t countNodes(const Node* node) {
+    if (!node) return 0;
+    size_t count = 1;
+    for (const Node* child : node->children) {
+        count += countNodes(child);
+    }
+    return count;
+}
+
+// Times every scan backend on the same directory (--bench-scan)
+void benchmarkScan(FileSystemTree& fileTree, const fs::path& path) {
+    const int runs = 3;
+    const std::vector<std::pair<FileSystemTree::ScanBackend, const char*>> backends = {
+        {FileSystemTree::THREAD_POOL, "thread pool"},
+        {FileSystemTree::IO_URING, "io_uring"},
+    };
+
+    std::cout << "Scanning " << path << " " << runs << " times per backend\n";
+    for (const auto& [backend, label] : backends) {
+        fileTree.scanBackend = backend;
+        double best = 0, total = 0;
+        size_t nodes = 0;
+        for (int run = 0; run < runs; ++run) {
+            NodeArena arena;
+            auto start = std::chrono::steady_clock::now();
+            Node* tree = fileTree.buildTree(path, arena);
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+            nodes = countNodes(tree);
+            total += elapsed.count();
+            best = run == 0 ? elapsed.count() : std::min(best, elapsed.count());
+        }
+        if (fileTree.scanBackend != backend) {
+            std::cout << "  " << std::setw(12) << std::left << label << "unavailable\n";
+            continue;
+        }
+        std::cout << "  " << std::setw(12) << std::left << label
+                  << nodes << " nodes, best " << std::fixed << std::setprecision(1)
+                  << best << "ms, avg " << total / runs << "ms\n";
+    }
+}
+
+// Times the search engine that each pattern gets against std::regex on an
+// equivalent expression, over generated names and paths, then the fuzzy
+// finder one key at a time (--bench-search)
+void benchmarkSearch() {
+    // 100 top-level folders x 100 subfolders x 50 files
+    const char* prefixes[] = {"build-", "src-", "docs-", "logs-"};
+    const char* extensions[] = {".log", ".cpp", ".txt", ".json", ".h"};
+    std::vector<std::string> paths;
+    paths.reserve(100 * 100 * 51 + 100);
+    for (int top = 0; top < 100; ++top) {
+        std::string topPath = prefixes[top % 4] + std::to_string(top);
+        paths.push_back(topPath);
+        for (int sub = 0; sub < 100; ++sub) {
+            std::string subPath = topPath + "/module" + std::to_string(sub);
+            paths.push_back(subPath);
+            for (int file = 0; file < 50; ++file) {
+                paths.push_back(subPath + "/File-" + std::to_string(file * 7919 % 1000) +
+                                extensions[file % 5]);
+            }
+        }
+    }
+    std::vector<std::string_view> names;
+    names.reserve(paths.size());
+    for (const std::string& path : paths) {
+        names.push_back(std::string_view(path).substr(path.rfind('/') + 1));
+    }
+
+    const std::vector<std::pair<const char*, const char*>> cases = {
+        {"file", "file"},
+        {"42", "42"},
+        {"file-838.txt", "file-838\\.txt"},
+        {"*.log", "^[^/]*\\.log$"},
+        {"build-*/**", "^build-[^/]*/.*$"},
+        {"src-1*/module?/*.cpp", "^src-1[^/]*/module[^/]/[^/]*\\.cpp$"},
+    };
+    const char* engines[] = {"auto", "text", "glob", "regex"};
+
+    std::cout << "Matching " << paths.size() << " generated entries\n";
+    for (const auto& [pattern, equivalent] : cases) {
+        SearchPattern fast(pattern);
+        SearchPattern regex(equivalent, SearchPattern::REGEX);
+        auto time = [&](const SearchPattern& matcher, size_t& count) {
+            auto start = std::chrono::steady_clock::now();
+            count = 0;
+            for (size_t i = 0; i < paths.size(); ++i) {
+                count += matcher.matches(fast.matchesPaths() ? std::string_view(paths[i]) : names[i]);
+            }
+            return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        };
+        size_t fastCount, regexCount;
+        double fastMs = time(fast, fastCount);
+        double regexMs = time(regex, regexCount);
+        std::cout << "  " << std::setw(24) << std::left << pattern
+                  << std::setw(6) << engines[fast.mode()] << fastCount << " matches, "
+                  << std::fixed << std::setprecision(1) << fastMs << "ms vs regex "
+                  << regexMs << "ms" << (fastCount == regexCount ? "" : " (regex disagrees)") << "\n";
+    }
+
+    // Fuzzy finding, one key at a time, over four copies of the entries
+    FuzzyFinder finder(std::thread::hardware_concurrency());
+    for (int copy = 0; copy < 4; ++copy) {
+        std::vector<uint32_t> folders; // top-level folder, then subfolder
+        for (size_t i = 0; i < paths.size(); ++i) {
+            size_t depth = std::count(paths[i].begin(), paths[i].end(), '/');
+            folders.resize(depth);
+            uint32_t entry = finder.add(names[i], depth ? folders[depth - 1] : FuzzyFinder::noParent);
+            if (depth < 2) folders.push_back(entry);
+        }
+    }
+    std::cout << "Fuzzy finding over " << finder.size() << " entries, per key:\n";
+    std::vector<FuzzyFinder::Match> best;
+    for (const std::string query : {"fil838", "src-1/mod7/f42"}) {
+        std::cout << "  ";
+        for (size_t length = 1; length <= query.size(); ++length) {
+            auto start = std::chrono::steady_clock::now();
+            size_t count = finder.search(query.substr(0, length), 15, best);
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+            std::cout << query.substr(0, length) << " " << count << " " << std::fixed << std::setprecision(1)
+                      << elapsed.count() << "ms" << (length < query.size() ? ", " : "\n");
+        }
+    }
+}
+
+// Checks the tree built by this program against std::filesystem on a tree
+// generated in the temporary directory (--self-test). Tree messages are
+// hidden; each check prints one line.
+class SelfTest {
+public:
+    explicit SelfTest(unsigned threads) : threads(threads), out(std::cout.rdbuf()) {
+        base = fs::temp_directory_path() /
+               ("fsm-self-test-" + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()));
+    }
+
+    ~SelfTest() {
+        std::error_code ec;
+        fs::remove_all(base, ec);
+    }
+
+    // Returns the number of failed checks
+    int run() {
+        makeTree();
+        const Listing disk = diskListing();
+        std::streambuf* saved = std::cout.rdbuf(quiet.rdbuf());
+
+        // Scanners
+        FileSystemTree scanned;
+        prepare(scanned);
+        scanned.rebuild(root, false);
+        check("thread pool scan matches the disk", treeListing(scanned) == disk);
+        FileSystemTree uring;
+        prepare(uring);
+        uring.scanBackend = FileSystemTree::IO_URING;
+        uring.rebuild(root, false);
+        if (uring.scanBackend == FileSystemTree::IO_URING) {
+            check("io_uring scan matches the disk", treeListing(uring) == disk);
+        } else {
+            out << "  skip io_uring scan (not available)\n";
+        }
+        check("totals after a scan", totalsHold(scanned));
+
+        // Snapshot round trip, searched and summed while still lazy
+        scanned.saveSnapshot();
+        FileSystemTree loaded;
+        prepare(loaded);
+        check("snapshot loads lazily", loaded.loadSnapshot(root) && loaded.snapshot && loaded.root->lazy);
+        FileSystemTree indexed;
+        prepare(indexed);
+        indexed.trigramSearch = true;
+        indexed.rebuild(root, false);
+        for (FileSystemTree* tree : {&scanned, &indexed, &loaded}) {
+            const char* label = tree == &scanned ? "" : tree == &indexed ? " (trigram index)" : " (lazy snapshot)";
+            checkSearches(*tree, disk, label);
+        }
+        // Escapes whose operands are not literal text must not narrow the
+        // index lookup to names containing them
+        for (const char* pattern : {"regex:\\x72eport", "regex:rep\\u006frt", "regex:(r)e\\1?port"}) {
+            scanned.searchFiles(pattern);
+            indexed.searchFiles(pattern);
+            check(std::string("trigram index agrees on ") + pattern,
+                  !scanned.searchResults.empty() && resultPaths(indexed) == resultPaths(scanned));
+        }
+        check("totals of a lazy snapshot", totalsHold(loaded));
+        check("snapshot round trip matches the disk", treeListing(loaded) == disk);
+        check("totals once the snapshot is loaded", totalsHold(loaded));
+
+        // Totals kept up to date through changes
+        Node* extra = scanned.createDirectory(scanned.root, "extra");
+        check("totals after creating a folder", extra && totalsHold(scanned));
+        check("totals after creating a file", extra && scanned.createFile(extra, "new.txt") && totalsHold(scanned));
+        check("totals after importing a file",
+              extra && scanned.importFile(extra, base / "outside.bin") && totalsHold(scanned));
+        check("totals after moving a folder",
+              scanned.renameNode(scanned.findByRelativePath("src/util"), scanned.findByRelativePath("logs"), "util") &&
+              totalsHold(scanned));
+        Node* oldest = scanned.findByRelativePath("logs/old/2019.log");
+        check("totals after renaming the oldest file",
+              oldest && scanned.renameNode(oldest, oldest->parent, "2019-renamed.log") && totalsHold(scanned));
+        check("totals after deleting a file",
+              scanned.deleteNode(scanned.findByRelativePath("docs"), scanned.findByRelativePath("docs/Report-final.log")) &&
+              totalsHold(scanned));
+        check("totals after deleting a folder",
+              scanned.deleteNode(scanned.root, scanned.findByRelativePath("many")) && totalsHold(scanned));
+
+        // The snapshot saved before those changes is now stale: loading it
+        // must rescan the changed folders, which were changed within
+        // moments of the scan
+        FileSystemTree reconciled;
+        prepare(reconciled);
+        check("stale snapshot reconciles with the disk",
+              reconciled.loadSnapshot(root) && totalsHold(reconciled) && treeListing(reconciled) == diskListing());
+        FileSystemTree::RefreshStats stats;
+        write(root / "docs/added.txt", 42);
+        check("refresh right after a change sees it",
+              reconciled.refresh(stats) && treeListing(reconciled) == diskListing());
+
+        std::cout.rdbuf(saved);
+        out << (failures ? std::to_string(failures) + " of " : "All ") << checks << " checks "
+            << (failures ? "failed" : "passed") << "\n";
+        return failures;
+    }
+
+private:
+    struct Item {
+        bool directory;
+        uintmax_t size;
+        FileTime lastModified;
+        bool operator==(const Item&) const = default;
+    };
+    using Listing = std::map<std::string, Item>; // by path relative to the root
+
+    unsigned threads;
+    fs::path base, root;
+    std::ostream out;
+    std::ostringstream quiet;
+    int checks = 0, failures = 0;
+
+    void check(const std::string& what, bool passed) {
+        ++checks;
+        if (!passed) ++failures;
+        out << (passed ? "  ok   " : "  FAIL ") << what << "\n";
+    }
+
+    void prepare(FileSystemTree& tree) const {
+        tree.scanThreads = threads;
+        tree.snapshotPath = base / "tree.snap";
+    }
+
+    void write(const fs::path& file, size_t size) const {
+        fs::create_directories(file.parent_path());
+        std::ofstream(file, std::ios::binary) << std::string(size, 'x');
+    }
+
+    void makeTree() {
+        root = base / "root";
+        const std::pair<const char*, size_t> files[] = {
+            {"docs/report-2024.txt", 100}, {"docs/Report-final.log", 2000}, {"docs/notes.md", 5},
+            {"src/main.cpp", 300}, {"src/util/io.cpp", 50}, {"src/util/io.h", 10},
+            {"src/util/deep/a/b/c.log", 7}, {"logs/app.log", 1234}, {"logs/app.log.1", 4321},
+            {"logs/old/2019.log", 1}, {"logs/old/report.txt", 3},
+        };
+        for (const auto& [path, size] : files) write(root / path, size);
+        for (int i = 0; i < 300; ++i) write(root / "many" / ("f" + std::to_string(i) + ".txt"), i % 17);
+        fs::create_directories(root / "empty");
+        fs::last_write_time(root / "logs/old/2019.log",
+                            fs::file_time_type::clock::now() - std::chrono::hours(24 * 365 * 5));
+        write(base / "outside.bin", 777);
+        root = fs::canonical(root);
+    }
+
+    Listing diskListing() const {
+        Listing listing;
+        for (const auto& entry : fs::recursive_directory_iterator(root)) {
+            bool directory = entry.is_directory();
+            listing[entry.path().lexically_relative(root).generic_string()] =
+                {directory, directory ? 0 : entry.file_size(), toFileTime(entry.last_write_time())};
+        }
+        return listing;
+    }
+
+    // Loads every lazy folder on the way
+    static void listTree(FileSystemTree& tree, Node* dir, const std::string& prefix, Listing& listing) {
+        tree.ensureLoaded(dir);
+        for (Node* child : dir->children) {
+            std::string path = prefix.empty() ? std::string(child->name()) : prefix + "/" + std::string(child->name());
+            bool directory = child->type == Node::DIRECTORY;
+            listing[path] = {directory, directory ? 0 : child->size(), child->lastModified};
+            if (directory) listTree(tree, child, path, listing);
+        }
+    }
+
+    static Listing treeListing(FileSystemTree& tree) {
+        Listing listing;
+        if (tree.root) listTree(tree, tree.root, "", listing);
+        return listing;
+    }
+
+    static bool sameTotals(const SubtreeTotals& a, const SubtreeTotals& b) {
+        return a.bytes == b.bytes && a.files == b.files && a.newest == b.newest;
+    }
+
+    // Recomputes the totals of every loaded folder from its children
+    static SubtreeTotals sumBelow(const FileSystemTree& tree, const Node* node, bool& consistent) {
+        if (node->type != Node::DIRECTORY || node->lazy) return tree.subtreeTotals(node);
+        SubtreeTotals sum;
+        for (const Node* child : node->children) sum.add(sumBelow(tree, child, consistent));
+        if (!sameTotals(sum, tree.subtreeTotals(node))) consistent = false;
+        return sum;
+    }
+
+    // Every folder's totals agree with its children, and the root's with the disk
+    bool totalsHold(const FileSystemTree& tree) const {
+        SubtreeTotals disk;
+        for (const auto& entry : fs::recursive_directory_iterator(root)) {
+            if (entry.is_directory()) continue;
+            disk.add({entry.file_size(), 1, toFileTime(entry.last_write_time())});
+        }
+        bool consistent = tree.root != nullptr;
+        return consistent && sameTotals(sumBelow(tree, tree.root, consistent), disk) && consistent;
+    }
+
+    // Compares the number of results with what the disk listing predicts
+    static std::vector<std::string> resultPaths(const FileSystemTree& tree) {
+        std::vector<std::string> paths;
+        for (const Node* node : tree.searchResults) paths.push_back(tree.relativePathOf(node));
+        std::sort(paths.begin(), paths.end());
+        return paths;
+    }
+
+    void checkSearches(FileSystemTree& tree, const Listing& disk, const std::string& label) {
+        auto expect = [&](auto&& predicate) {
+            size_t count = 0;
+            for (const auto& [path, item] : disk) {
+                std::string name = path.substr(path.rfind('/') + 1);
+                std::transform(name.begin(), name.end(), name.begin(),
+                               [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+                count += predicate(path, name, item);
+            }
+            return count;
+        };
+        auto endsWith = [](const std::string& text, const std::string& tail) {
+            return text.size() >= tail.size() && text.compare(text.size() - tail.size(), tail.size(), tail) == 0;
+        };
+        const std::regex numbered("^f1[0-9]\\.txt$");
+
+        tree.searchFiles("report");
+        check("text search" + label, tree.searchResults.size() ==
+              expect([](auto&, const std::string& name, auto&) { return name.find("report") != std::string::npos; }));
+        tree.searchFiles("*.log");
+        check("glob search" + label, tree.searchResults.size() ==
+              expect([&](auto&, const std::string& name, auto&) { return endsWith(name, ".log"); }));
+        tree.searchFiles("logs/**");
+        check("path glob search" + label, tree.searchResults.size() ==
+              expect([](const std::string& path, auto&, auto&) { return path.rfind("logs/", 0) == 0; }));
+        tree.searchFiles("regex:^f1[0-9]\\.txt$");
+        check("regex search" + label, tree.searchResults.size() ==
+              expect([&](auto&, const std::string& name, auto&) { return std::regex_search(name, numbered); }));
+        tree.queryTree("ext:log size>1000");
+        check("query" + label, tree.searchResults.size() ==
+              expect([&](auto&, const std::string& name, const Item& item) {
+                  return !item.directory && endsWith(name, ".log") && item.size > 1000;
+              }));
+        tree.queryTree("logs/** type:dir");
+        check("query with a path glob" + label, tree.searchResults.size() ==
+              expect([](const std::string& path, auto&, const Item& item) {
+                  return item.directory && path.rfind("logs/", 0) == 0;
+              }));
+    }
+};
+
+int main(int argc, char* argv[]) {
     FileSystemTree fileTree;
     fs::path startPath = fs::current_path();
 
+    // Options: --threads N, --scan-backend threads|uring, --bench-scan, --bench-search,
+    // --self-test, --no-snapshot, --no-watch, --trigram-index (values may also be given as
+    // --option=value)
+    bool benchScan = false;
+    bool selfTest = false;
+    bool watch = true;
+    fileTree.snapshotPath = TreeSnapshot::defaultPath(startPath);
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        std::string option = arg.substr(0, arg.find('='));
+        std::string value;
+        if (option != arg) {
+            value = arg.substr(option.size() + 1);
+        } else if ((arg == "--threads" || arg == "--scan-backend") && i + 1 < argc) {
+            value = argv[++i];
+        }
+
+        if (option == "--threads") {
+            try {
+                fileTree.scanThreads = static_cast<unsigned>(std::stoul(value));
+            } catch (...) {
+                std::cerr << "Invalid thread count: " << value << "\n";
+            }
+        } else if (option == "--scan-backend") {
+            if (value == "threads") {
+                fileTree.scanBackend = FileSystemTree::THREAD_POOL;
+            } else if (value == "uring") {
+                fileTree.scanBackend = FileSystemTree::IO_URING;
+            } else {
+                std::cerr << "Unknown scan backend: " << value << " (use threads or uring)\n";
+            }
+        } else if (arg == "--bench-scan") {
+            benchScan = true;
+        } else if (arg == "--bench-search") {
+            benchmarkSearch();
+            return 0;
+        } else if (arg == "--self-test") {
+            selfTest = true;
+        } else if (arg == "--no-snapshot") {
+            fileTree.snapshotPath.clear();
+        } else if (arg == "--no-watch") {
+            watch = false;
+        } else if (arg == "--trigram-index") {
+            fileTree.trigramSearch = true;
+        } else {
+            std::cerr << "Unknown option: " << arg << "\n";
+        }
+    }
+
+    if (benchScan) {
+        benchmarkScan(fileTree, startPath);
+        return 0;
+    }
+    if (selfTest) {
+        return SelfTest(fileTree.scanThreads).run() ? 1 : 0;
+    }
+
     std::cout << "Initializing file tree from: " << startPath << "\n";
-    fileTree.root = fileTree.buildTree(startPath);
-    if (!fileTree.root) {
-        std::cerr << "Failed to initialize file tree.\n";
-        return 1;
+    if (!fileTree.loadSnapshot(startPath)) {
+        if (!fileTree.rebuild(startPath)) {
+            std::cerr << "Failed to initialize file tree.\n";
+            return 1;
+        }
+        fileTree.saveSnapshot();
     }
 
+    // Applies file system changes in the background; from here on the tree
+    // is only touched while holding fileTree.mutex, which is never held
+    // while waiting for the user
+    TreeWatcher watcher(fileTree);
+    if (watch) watcher.start();
+
     int choice;
     std::string input, name, parentName, newName, sourcePathStr;
 
+    // An item chosen at a prompt, looked up again under the lock because the
+    // watcher may have changed the tree while the user was typing
+    auto chosen = [&](const std::string& relativePath) -> Node* {
+        return relativePath.empty() ? nullptr : fileTree.findByRelativePath(relativePath);
+    };
+    auto isFolder = [&](const std::string& relativePath) {
+        std::lock_guard<std::mutex> lock(fileTree.mutex);
+        Node* node = chosen(relativePath);
+        return node && node->type == Node::DIRECTORY;
+    };
+
     do {
-        clearScreen();
-        // Always display the tree first for context
-        fileTree.displayTree();
+        {
+            std::lock_guard<std::mutex> lock(fileTree.mutex);
+            clearScreen();
+            // Always display the tree first for context
+            fileTree.displayTree();
+        }
         displayMainMenu();
 
         // Use a temporary string to read the whole line for choice to handle potential
@@ -553,30 +5708,36 @@ int main() {
             choice = 0; // Invalid choice (too large/small)
         }
 
-
-        Node* selectedNode = nullptr;
-        Node* parentNode = nullptr;
+        std::string selectedPath, parentPath;
 
         switch (choice) {
             case 1: // Display basic tree (already done at start of loop)
                 pressEnterToContinue();
                 break;
-            case 2: // Detailed view
-                clearScreen(); // Clear again to show only detailed tree
-                fileTree.displayTree(true);
+            case 2: { // Detailed view
+                {
+                    std::lock_guard<std::mutex> lock(fileTree.mutex);
+                    clearScreen(); // Clear again to show only detailed tree
+                    fileTree.displayTree(true);
+                }
                 pressEnterToContinue();
                 break;
+            }
             case 3: { // Add folder
                 std::cout << "Parent folder (blank for current directory): ";
                 std::getline(std::cin, parentName);
-                parentNode = parentName.empty() ? fileTree.root.get() :
-                    fileTree.findNode(fileTree.root.get(), parentName); // findNode is still problematic for ambiguity
+                parentPath = parentName.empty() ? "." : chooseNode(fileTree, parentName);
 
-                if (parentNode && parentNode->type == Node::DIRECTORY) {
+                if (isFolder(parentPath)) {
                     std::cout << "New folder name: ";
                     std::getline(std::cin, name);
                     if (!name.empty()) { // Basic validation
-                         fileTree.createDirectory(parentNode, name);
+                        std::lock_guard<std::mutex> lock(fileTree.mutex);
+                        if (Node* parentNode = chosen(parentPath)) {
+                            fileTree.createDirectory(parentNode, name);
+                        } else {
+                            std::cout << "The parent folder no longer exists.\n";
+                        }
                     } else {
                         std::cout << "Folder name cannot be empty.\n";
                     }
@@ -589,14 +5750,18 @@ int main() {
             case 4: { // Add file
                 std::cout << "Parent folder (blank for current directory): ";
                 std::getline(std::cin, parentName);
-                parentNode = parentName.empty() ? fileTree.root.get() :
-                    fileTree.findNode(fileTree.root.get(), parentName);
+                parentPath = parentName.empty() ? "." : chooseNode(fileTree, parentName);
 
-                if (parentNode && parentNode->type == Node::DIRECTORY) {
+                if (isFolder(parentPath)) {
                     std::cout << "New file name: ";
                     std::getline(std::cin, name);
                     if (!name.empty()) { // Basic validation
-                        fileTree.createFile(parentNode, name);
+                        std::lock_guard<std::mutex> lock(fileTree.mutex);
+                        if (Node* parentNode = chosen(parentPath)) {
+                            fileTree.createFile(parentNode, name);
+                        } else {
+                            std::cout << "The parent folder no longer exists.\n";
+                        }
                     } else {
                         std::cout << "File name cannot be empty.\n";
                     }
@@ -611,13 +5776,16 @@ int main() {
                 std::getline(std::cin, sourcePathStr);
                 std::cout << "Destination folder (blank for current directory): ";
                 std::getline(std::cin, parentName);
-                parentNode = parentName.empty() ? fileTree.root.get() :
-                    fileTree.findNode(fileTree.root.get(), parentName);
+                parentPath = parentName.empty() ? "." : chooseNode(fileTree, parentName);
 
-                if (parentNode && parentNode->type == Node::DIRECTORY) {
-                    fileTree.importFile(parentNode, fs::path(sourcePathStr));
-                } else {
-                    std::cout << "Invalid or non-existent destination directory.\n";
+                {
+                    std::lock_guard<std::mutex> lock(fileTree.mutex);
+                    Node* parentNode = chosen(parentPath);
+                    if (parentNode && parentNode->type == Node::DIRECTORY) {
+                        fileTree.importFile(parentNode, fs::path(sourcePathStr));
+                    } else {
+                        std::cout << "Invalid or non-existent destination directory.\n";
+                    }
                 }
                 pressEnterToContinue();
                 break;
@@ -625,11 +5793,22 @@ int main() {
             case 6: { // Open file
                 std::cout << "File name to open: ";
                 std::getline(std::cin, name);
-                selectedNode = fileTree.findNode(fileTree.root.get(), name); // Still has ambiguity
-                if (selectedNode) {
-                    fileTree.openFile(selectedNode);
+                selectedPath = chooseNode(fileTree, name);
+                fs::path filePath;
+                bool isFile = false;
+                {
+                    std::lock_guard<std::mutex> lock(fileTree.mutex);
+                    if (Node* selectedNode = chosen(selectedPath)) {
+                        filePath = selectedNode->path();
+                        isFile = selectedNode->type == Node::FILE;
+                    }
+                }
+                if (filePath.empty()) {
+                    std::cout << "File not found.\n";
+                } else if (!isFile) {
+                    std::cerr << "Error: Invalid file node.\n";
                 } else {
-                    std::cout << "File not found. (Note: if multiple files have this name, only the first found is considered.)\n";
+                    fileTree.openFile(filePath);
                 }
                 pressEnterToContinue();
                 break;
@@ -637,24 +5816,26 @@ int main() {
             case 7: { // Rename
                 std::cout << "Item to rename: ";
                 std::getline(std::cin, name);
-                selectedNode = fileTree.findNode(fileTree.root.get(), name); // Still has ambiguity
-                if (selectedNode) {
+                selectedPath = chooseNode(fileTree, name);
+                if (selectedPath == ".") {
+                    std::cout << "Renaming the root directory is not supported via this menu (it corresponds to the program's starting directory).\n";
+                } else if (!selectedPath.empty()) {
                     std::cout << "New name: ";
                     std::getline(std::cin, newName);
                     if (!newName.empty()) {
-                        Node* parent = fileTree.findParent(fileTree.root.get(), selectedNode);
-                        if (parent) { // Cannot rename root using this mechanism easily without changing `findParent` logic or having a direct root check
+                        std::lock_guard<std::mutex> lock(fileTree.mutex);
+                        Node* selectedNode = chosen(selectedPath);
+                        Node* parent = selectedNode ? fileTree.findParent(selectedNode) : nullptr;
+                        if (parent) { // Only the root has no parent
                             fileTree.renameNode(selectedNode, parent, newName); // Assumes newParent is same as oldParent for rename
-                        } else if (selectedNode == fileTree.root.get()) {
-                             std::cout << "Renaming the root directory is not supported via this menu (it corresponds to the program's starting directory).\n";
                         } else {
-                            std::cout << "Error finding parent of the item.\n";
+                            std::cout << "Item not found.\n";
                         }
                     } else {
                         std::cout << "New name cannot be empty.\n";
                     }
                 } else {
-                    std::cout << "Item not found. (Note: if multiple items have this name, only the first found is considered.)\n";
+                    std::cout << "Item not found.\n";
                 }
                 pressEnterToContinue();
                 break;
@@ -662,48 +5843,115 @@ int main() {
             case 8: { // Delete
                 std::cout << "Item to delete: ";
                 std::getline(std::cin, name);
-                selectedNode = fileTree.findNode(fileTree.root.get(), name); // Still has ambiguity
-                if (selectedNode) {
-                    if (selectedNode == fileTree.root.get()) {
-                        std::cout << "Cannot delete root directory.\n";
-                    } else {
-                        Node* parent = fileTree.findParent(fileTree.root.get(), selectedNode);
+                selectedPath = chooseNode(fileTree, name);
+                if (selectedPath == ".") {
+                    std::cout << "Cannot delete root directory.\n";
+                } else if (!selectedPath.empty()) {
+                    std::cout << "Confirm delete '" << fs::path(selectedPath).filename().string() << "'? (y/n): ";
+                    char confirm;
+                    std::cin >> confirm;
+                    std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n'); // Clear buffer after char read
+                    if (confirm == 'y' || confirm == 'Y') {
+                        std::lock_guard<std::mutex> lock(fileTree.mutex);
+                        Node* selectedNode = chosen(selectedPath);
+                        Node* parent = selectedNode ? fileTree.findParent(selectedNode) : nullptr;
                         if (parent) {
-                            std::cout << "Confirm delete '" << name << "'? (y/n): ";
-                            char confirm;
-                            std::cin >> confirm;
-                            std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n'); // Clear buffer after char read
-                            if (confirm == 'y' || confirm == 'Y') {
-                                fileTree.deleteNode(parent, selectedNode);
-                            } else {
-                                std::cout << "Deletion cancelled.\n";
-                            }
+                            fileTree.deleteNode(parent, selectedNode);
                         } else {
-                            std::cout << "Error finding parent to delete.\n";
+                            std::cout << "Item not found.\n";
                         }
+                    } else {
+                        std::cout << "Deletion cancelled.\n";
                     }
                 } else {
-                    std::cout << "Item not found. (Note: if multiple items have this name, only the first found is considered.)\n";
+                    std::cout << "Item not found.\n";
                 }
                 pressEnterToContinue();
                 break;
             }
             case 9: { // Search
-                std::cout << "Search pattern (regex): ";
+                std::cout << "Search file (n)ames, file (c)ontents, or (q)uery by size/date/type? [n]: ";
+                std::string mode;
+                std::getline(std::cin, mode);
+                bool contents = mode == "c" || mode == "C";
+                bool query = mode == "q" || mode == "Q";
+                std::cout << (contents ? "Text to find: " :
+                              query ? "Query (e.g. ext:log size>100M mtime<30d type:file path:~/var/): " :
+                                      "Search (text, glob such as *.log, or regex): ");
                 std::getline(std::cin, name);
-                fileTree.searchFiles(name);
-                fileTree.displaySearchResults();
+                std::cout << "Stop after how many results (blank for all): ";
+                std::getline(std::cin, input);
+                size_t limit = 0;
+                try {
+                    if (!input.empty()) limit = std::stoul(input);
+                } catch (const std::exception&) {
+                    std::cout << "Invalid number, showing all results.\n";
+                }
+
+                // Results are printed as they are found
+                std::unique_lock<std::mutex> lock(fileTree.mutex);
+                if (contents) {
+                    if (name.empty()) {
+                        std::cout << "Search text cannot be empty.\n";
+                    } else {
+                        size_t found = fileTree.searchContents(name, limit,
+                            [](const fs::path& file, const ContentSearch::Hit& hit) {
+                                std::cout << file.string() << ":" << hit.line << ": " << hit.text << "\n";
+                            });
+                        std::cout << found << " matching line(s)"
+                                  << (limit && found >= limit ? ", limit reached" : "") << ".\n";
+                    }
+                    lock.unlock();
+                    pressEnterToContinue();
+                    break;
+                }
+                std::cout << "Search results for: " << name << "\n";
+                if (query) {
+                    fileTree.queryTree(name, limit, FileSystemTree::printSearchResult);
+                } else {
+                    fileTree.searchFiles(name, limit, FileSystemTree::printSearchResult);
+                }
+                if (fileTree.searchResults.empty()) {
+                    std::cout << "No results found.\n";
+                } else {
+                    std::cout << fileTree.searchResults.size() << " result(s)"
+                              << (limit && fileTree.searchResults.size() >= limit ? ", limit reached" : "")
+                              << ".\n";
+                }
+                lock.unlock();
                 pressEnterToContinue();
                 break;
             }
-            case 10: // Refresh
-                fileTree.root = fileTree.buildTree(startPath);
-                std::cout << "File tree refreshed.\n";
+            case 10: { // Refresh
+                std::cout << "Quick refresh (only rescan folders whose contents changed)? (Y/n): ";
+                std::string answer;
+                std::getline(std::cin, answer);
+                {
+                    std::lock_guard<std::mutex> lock(fileTree.mutex);
+                    if (answer == "n" || answer == "N") {
+                        fileTree.rebuild(startPath);
+                        fileTree.releaseSnapshot();
+                        std::cout << "File tree rebuilt.\n";
+                    } else {
+                        FileSystemTree::RefreshStats stats;
+                        if (fileTree.refresh(stats)) {
+                            std::cout << "File tree refreshed: checked " << stats.directoriesChecked
+                                      << " folders, rescanned " << stats.directoriesRescanned << ".\n";
+                        } else {
+                            std::cout << "The starting directory no longer exists.\n";
+                        }
+                    }
+                    fileTree.saveSnapshot();
+                }
                 pressEnterToContinue();
                 break;
-            case 11: // Exit
+            }
+            case 11: { // Exit
+                std::lock_guard<std::mutex> lock(fileTree.mutex);
+                fileTree.saveSnapshot();
                 std::cout << "Exiting...\n";
                 break;
+            }
             default:
                 std::cout << "Invalid choice. Please enter a number between 1 and 11.\n";
                 pressEnterToContinue();